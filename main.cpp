@@ -13,307 +13,6684 @@
 #include <csignal>   // for signal handling
 #include <unistd.h>  // to get the number of clock ticks per second
 #include <map>
+#include <unordered_map>
 #include <functional>
+#include <charconv> // for from_chars
+#include <cstring>  // for memchr/memrchr
+#include <fcntl.h>  // for open
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sys/prctl.h> // for PR_SET_PDEATHSIG
+#include <sys/wait.h>  // for waitpid
+#include <sys/ioctl.h> // for TIOCGWINSZ
+#include <cerrno>
+#include <deque>
+#include <sys/resource.h> // for RLIMIT_NOFILE
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctime>
+#include <ftw.h> // for nftw, to remove benchmark fixtures
+#include <new>
+#include <cstdlib>
+#include <sys/syscall.h> // for SYS_getdents64
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <cmath> // for llround
 using namespace std;
 
+// where process information is read from. --proc-root points it at another
+// tree with the same layout, e.g. the synthetic one the benchmarks generate.
+string procRoot = "/proc";
+
+// every heap allocation of the program, counted by the operator new
+// replacements below for the stats and the benchmarks. a relaxed increment
+// is cheap enough to leave on. none of them may be inlined: gcc would then
+// see a plain free() of what the (not inlined) operator new returned and warn
+// about mismatched allocation functions.
+atomic<uint64_t> heapAllocations{0};
+
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void *operator new[](size_t size) { return operator new(size); }
+__attribute__((noinline)) void operator delete(void *memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void *memory) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete(void *memory, size_t) noexcept { free(memory); }
+__attribute__((noinline)) void operator delete[](void *memory, size_t) noexcept { free(memory); }
+
+enum class ChangeKind // what happened to a process since the previous refresh
+{
+    None,
+    Added,
+    Changed
+};
+
+// syscalls made by the per-pid /proc read path, for stats and benchmarks
+struct ProcReadCounters
+{
+    atomic<uint64_t> opens{0};
+    atomic<uint64_t> reads{0};
+    atomic<uint64_t> closes{0};
+    atomic<uint64_t> bytes{0};
+    atomic<uint64_t> submits{0}; // io_uring_enter calls of the io_uring backend
+};
+
+ProcReadCounters procReadCounters;
+
+// where the time of a refresh goes. read and parse are summed over the scan
+// threads (so with several threads they can add up to more than the wall
+// time), the other phases are wall time on the main thread.
+enum class Phase
+{
+    Enumerate, // readdir of /proc or draining the proc connector
+    Read,      // open/read/pread of the per-pid files
+    Parse,     // everything else in the scan
+    Users,     // uid -> user name
+    Merge,     // updating the table, diff and tree
+    History,
+    Threads,   // the whole thread view walk: task directories, per-task reads and merge
+    Cgroups,   // cgroup of new pids plus one sample of every cgroup in use
+    Watchdog,  // checking the watchdog rules against the snapshot
+    SortFilter,
+    Render,
+    Count
+};
+
+const char *const phaseNames[] = {"enumerate", "read", "parse", "users", "merge", "history", "threads", "cgroups", "watchdog", "sort/filter", "render"};
+
+// per-phase times and counters of the last refresh plus running totals.
+// only touched from the main thread; the scan threads report through
+// scanReadNanos and ProcessTable::refresh().
+struct RefreshStats
+{
+    static const int Phases = (int)Phase::Count;
+    double lastMs[Phases] = {};
+    uint64_t lastAllocations[Phases] = {};
+    double totalMs[Phases] = {};
+    uint64_t samples[Phases] = {};
+
+    // the phases of the refresh (or view) in progress, see finish()
+    double currentMs[Phases] = {};
+    uint64_t currentAllocations[Phases] = {};
+    bool recorded[Phases] = {};
+
+    // /proc syscalls, bytes and heap allocations of the last refresh() call
+    uint64_t opens = 0, reads = 0, bytes = 0, allocations = 0;
+    uint64_t refreshes = 0;
+    bool statusLine = false; // print a one-line summary under every table
+
+    // a phase may run in several parts in one refresh, so the parts add up
+    // until finish() turns them into one sample
+    void add(Phase phase, double ms, uint64_t allocationCount = 0)
+    {
+        int index = (int)phase;
+        currentMs[index] += ms;
+        currentAllocations[index] += allocationCount;
+        recorded[index] = true;
+    }
+
+    // ends the current sample of the phases first..last that were recorded
+    void finish(Phase first, Phase last)
+    {
+        for (int index = (int)first; index <= (int)last; index++)
+        {
+            if (!recorded[index])
+                continue;
+            lastMs[index] = currentMs[index];
+            lastAllocations[index] = currentAllocations[index];
+            totalMs[index] += currentMs[index];
+            samples[index]++;
+            currentMs[index] = 0;
+            currentAllocations[index] = 0;
+            recorded[index] = false;
+        }
+    }
+
+    double refreshMs() const
+    {
+        double sum = 0;
+        for (int phase = 0; phase <= (int)Phase::Cgroups; phase++)
+            sum += lastMs[phase];
+        return sum;
+    }
+
+    string summary() const
+    {
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "refresh %.1fms (enum %.1f read %.1f parse %.1f users %.1f merge %.1f) view %.1fms render %.1fms | %llu opens %.0fKB %llu allocs",
+                 refreshMs(), lastMs[(int)Phase::Enumerate], lastMs[(int)Phase::Read], lastMs[(int)Phase::Parse],
+                 lastMs[(int)Phase::Users], lastMs[(int)Phase::Merge], lastMs[(int)Phase::SortFilter],
+                 lastMs[(int)Phase::Render], (unsigned long long)opens, bytes / 1024.0, (unsigned long long)allocations);
+        return line;
+    }
+};
+
+RefreshStats refreshStats;
+
+// nanoseconds this thread spent reading /proc files, see readCached()
+thread_local uint64_t scanReadNanos = 0;
+
+// times a phase on the main thread from construction to destruction
+class PhaseTimer
+{
+private:
+    Phase phase;
+    chrono::steady_clock::time_point start;
+    uint64_t allocations;
+
+public:
+    PhaseTimer(Phase p) : phase(p), start(chrono::steady_clock::now()), allocations(heapAllocations.load(memory_order_relaxed)) {}
+    ~PhaseTimer()
+    {
+        refreshStats.add(phase, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(),
+                         heapAllocations.load(memory_order_relaxed) - allocations);
+        refreshStats.finish(phase, phase);
+    }
+};
+
+// reads /proc/<pid>/<file> with a single read() into buf and null-terminates it.
+// with a tgid, the file of task <pid> of that process (/proc/<tgid>/task/<pid>).
+// returns the number of bytes read, or -1 if the file could not be opened.
+ssize_t readProcFile(int pid, const char *file, char *buf, size_t size, int tgid = 0)
+{
+    char path[PATH_MAX];
+    if (tgid)
+        snprintf(path, sizeof(path), "%s/%d/task/%d/%s", procRoot.c_str(), tgid, pid, file);
+    else
+        snprintf(path, sizeof(path), "%s/%d/%s", procRoot.c_str(), pid, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+    if (fd < 0)
+        return -1;
+    ssize_t bytesRead = read(fd, buf, size - 1); // procfs generates the whole file on the first read
+    close(fd);
+    procReadCounters.reads.fetch_add(1, memory_order_relaxed);
+    procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+    if (bytesRead < 0)
+        return -1;
+    procReadCounters.bytes.fetch_add(bytesRead, memory_order_relaxed);
+    buf[bytesRead] = '\0';
+    return bytesRead;
+}
+
+// one record of getdents64(2), the kernel's layout
+struct Dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// appends the numeric entries of an open /proc directory (the pids, or the
+// tids of a task directory) to ids. rewinds first, so the same fd can be
+// listed again on every refresh. getdents64 fills a 64KB buffer per call,
+// a few hundred entries, with no DIR stream to allocate.
+bool listNumericEntries(int fd, vector<int> &ids)
+{
+    alignas(8) static thread_local char buffer[65536];
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        return false;
+    while (true)
+    {
+        long length = syscall(SYS_getdents64, fd, buffer, sizeof(buffer));
+        procReadCounters.reads.fetch_add(1, memory_order_relaxed);
+        if (length <= 0)
+            return length == 0;
+        for (long offset = 0; offset < length;)
+        {
+            const Dirent64 *entry = (const Dirent64 *)(buffer + offset);
+            offset += entry->d_reclen;
+            if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) // DT_UNKNOWN: fixture trees on filesystems without d_type
+                continue;
+            const char *end = entry->d_name + strlen(entry->d_name);
+            int id = 0;
+            auto [next, ec] = from_chars(entry->d_name, end, id);
+            if (ec == errc() && next == end && id > 0)
+                ids.push_back(id);
+        }
+    }
+}
+
+// how many descriptors the per-pid fd cache may hold: the soft RLIMIT_NOFILE
+// (raised to the hard limit when allowed) minus headroom for everything else.
+// when it runs out, pids are simply read without caching.
+class FdBudget
+{
+private:
+    atomic<long> used{0};
+    long limit = 0;
+
+public:
+    static const long Headroom = 256;
+
+    void init()
+    {
+        rlimit limits;
+        if (getrlimit(RLIMIT_NOFILE, &limits) != 0)
+            return;
+        if (limits.rlim_cur < limits.rlim_max)
+        {
+            rlimit raised = limits;
+            raised.rlim_cur = min<rlim_t>(limits.rlim_max, 1 << 20);
+            if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+                limits = raised;
+        }
+        limit = max<long>(0, (long)min<rlim_t>(limits.rlim_cur, 1 << 20) - Headroom);
+    }
+
+    bool acquire()
+    {
+        if (used.fetch_add(1, memory_order_relaxed) >= limit)
+        {
+            used.fetch_sub(1, memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void release() { used.fetch_sub(1, memory_order_relaxed); }
+    long getUsed() const { return used; }
+    long getLimit() const { return limit; }
+};
+
+FdBudget fdBudget;
+
+// a minimal io_uring on the raw syscalls (no liburing): one submission and
+// one completion ring, mapped once. each scan thread owns one, so nothing here
+// is shared between threads.
+class IoUring
+{
+private:
+    int ringFd = -1;
+    unsigned entries = 0;
+    void *sqRing = MAP_FAILED;
+    void *cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0;
+    io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_cqe *cqes;
+    unsigned tail = 0;          // sqes handed out, published to the kernel on submit()
+    unsigned submitted = 0;
+
+public:
+    IoUring() = default;
+    IoUring(const IoUring &) = delete;
+
+    ~IoUring()
+    {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, entries * sizeof(io_uring_sqe));
+        if (cqRing != MAP_FAILED && cqRing != sqRing)
+            munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (ringFd >= 0)
+            close(ringFd);
+    }
+
+    // false (with the reason) if io_uring is missing, disabled by the
+    // kernel.io_uring_disabled sysctl or blocked by a seccomp filter
+    bool init(unsigned size, string &error)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = syscall(__NR_io_uring_setup, size, &params);
+        if (ringFd < 0)
+        {
+            error = string("io_uring_setup: ") + strerror(errno);
+            return false;
+        }
+        entries = params.sq_entries;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap)
+            sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe *)mmap(nullptr, entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            error = string("mmap of the io_uring rings: ") + strerror(errno);
+            return false;
+        }
+        char *sq = (char *)sqRing, *cq = (char *)cqRing;
+        sqHead = (unsigned *)(sq + params.sq_off.head);
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+        tail = submitted = *sqTail;
+        return true;
+    }
+
+    unsigned size() const { return entries; }
+
+    // a zeroed sqe to fill in, null if the ring is full
+    io_uring_sqe *next()
+    {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (tail - head >= entries)
+            return nullptr;
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        tail++;
+        return sqe;
+    }
+
+    // hand everything prepared since the last call to the kernel, and wait
+    // for at least waitFor completions, with one io_uring_enter()
+    bool submit(unsigned waitFor)
+    {
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+        unsigned count = tail - submitted;
+        while (true)
+        {
+            int done = syscall(__NR_io_uring_enter, ringFd, count, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            procReadCounters.submits.fetch_add(1, memory_order_relaxed);
+            if (done >= 0)
+            {
+                submitted += done;
+                count -= done;
+                if (count == 0)
+                    return true;
+                continue; // the kernel took only part of it
+            }
+            if (errno != EINTR)
+                return false;
+        }
+    }
+
+    // calls done(user_data, res) for every completion that has arrived
+    template <typename Callback>
+    size_t reap(Callback done)
+    {
+        unsigned head = *cqHead;
+        unsigned cqTailNow = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        size_t count = 0;
+        for (; head != cqTailNow; head++, count++)
+        {
+            const io_uring_cqe &cqe = cqes[head & *cqMask];
+            done(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+};
+
+// the files the io_uring backend read for the process being scanned, see
+// ProcessTable::prefetchChunk(). readCached() takes them from here instead of
+// reading them itself.
+struct PrefetchedFiles
+{
+    static const int MaxFiles = 2; // stat, plus status or statm
+    int count = 0;
+    const char *file[MaxFiles];
+    char *data[MaxFiles];
+    ssize_t length[MaxFiles]; // bytes read, -1 if the backend could not read it
+};
+
+thread_local const PrefetchedFiles *prefetchedFiles = nullptr;
+
+// the io_uring of one scan thread and the buffers its reads land in, see
+// ProcessTable::prefetchChunk(). set up on the thread's first chunk.
+struct ScanRing
+{
+    static const unsigned Entries = 256; // at most one op per file of a chunk is in flight
+    static const size_t StatBytes = 4096;
+    static const size_t SlotBytes = StatBytes + 8192; // stat, then status or statm
+
+    struct Slot
+    {
+        PrefetchedFiles files;
+        int fd[PrefetchedFiles::MaxFiles];
+        bool opened[PrefetchedFiles::MaxFiles]; // by the ring, for this chunk
+        string path[PrefetchedFiles::MaxFiles];
+        int remaining; // files not read or given up on yet
+    };
+
+    unique_ptr<IoUring> ring;
+    bool failed = false; // no io_uring here (or it broke), this thread reads synchronously
+    vector<Slot> slots;
+    vector<char> buffers;
+};
+
+thread_local ScanRing scanRing;
+
+// whether the io_uring backend works here: sets up a ring and opens, reads
+// and closes /proc/self/stat through it
+bool probeIoUring(string &error)
+{
+    IoUring ring;
+    if (!ring.init(4, error))
+        return false;
+    char buffer[1024];
+    int fd = -1;
+    ssize_t length = -1;
+    for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE})
+    {
+        io_uring_sqe *sqe = ring.next();
+        sqe->opcode = op;
+        if (op == IORING_OP_OPENAT)
+        {
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t) "/proc/self/stat";
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        else
+        {
+            sqe->fd = fd;
+            sqe->addr = op == IORING_OP_READ ? (uint64_t)buffer : 0;
+            sqe->len = op == IORING_OP_READ ? sizeof(buffer) : 0;
+        }
+        int result = -ENOSYS;
+        if (!ring.submit(1))
+        {
+            error = string("io_uring_enter: ") + strerror(errno);
+            return false;
+        }
+        ring.reap([&result](uint64_t, int res) { result = res; });
+        if (result < 0)
+        {
+            if (fd >= 0 && op != IORING_OP_CLOSE)
+                close(fd);
+            error = string("io_uring ") + (op == IORING_OP_OPENAT ? "openat" : op == IORING_OP_READ ? "read" : "close") +
+                    ": " + strerror(-result);
+            return false;
+        }
+        if (op == IORING_OP_OPENAT)
+            fd = result;
+        else if (op == IORING_OP_READ)
+            length = result;
+    }
+    if (length <= 0)
+    {
+        error = "io_uring read of /proc/self/stat returned nothing";
+        return false;
+    }
+    return true;
+}
+
+// the fields of /proc/<pid>/stat that we use. comm points into the parsed buffer.
+struct StatFields
+{
+    const char *comm = nullptr;
+    size_t commLength = 0;
+    char state = '?';
+    int ppid = 0;
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    int priority = 0; // the nice value (19th field), which is what we have always shown as priority
+    long numThreads = 0;
+    unsigned long long starttime = 0;
+};
+
+// parses a stat line in place without allocating. comm can contain spaces and
+// ')' so it spans from the first '(' to the last ')'; the numeric fields after
+// it are read with from_chars.
+bool parseStatLine(const char *buf, size_t length, StatFields &fields)
+{
+    const char *end = buf + length;
+    const char *openParen = (const char *)memchr(buf, '(', length);
+    if (!openParen)
+        return false;
+    const char *closeParen = (const char *)memrchr(openParen, ')', end - openParen);
+    if (!closeParen || closeParen + 2 >= end)
+        return false;
+
+    fields.comm = openParen + 1;
+    fields.commLength = closeParen - openParen - 1;
+
+    // field 3 (state) is index 0 here, field 22 (starttime) is index 19
+    const char *cursor = closeParen + 2;
+    int index = 0;
+    for (; index <= 19 && cursor < end; index++)
+    {
+        const char *tokenEnd = cursor;
+        while (tokenEnd < end && *tokenEnd != ' ' && *tokenEnd != '\n')
+            tokenEnd++;
+
+        switch (index)
+        {
+        case 0:
+            fields.state = *cursor;
+            break;
+        case 1:
+            from_chars(cursor, tokenEnd, fields.ppid);
+            break;
+        case 11:
+            from_chars(cursor, tokenEnd, fields.utime);
+            break;
+        case 12:
+            from_chars(cursor, tokenEnd, fields.stime);
+            break;
+        case 16:
+            from_chars(cursor, tokenEnd, fields.priority);
+            break;
+        case 17:
+            from_chars(cursor, tokenEnd, fields.numThreads);
+            break;
+        case 19:
+            from_chars(cursor, tokenEnd, fields.starttime);
+            break;
+        }
+        cursor = tokenEnd + 1;
+    }
+    return index > 19;
+}
+
+// picks the real uid, VmRSS (kB) and the context switch counts out of a
+// /proc/<pid>/status buffer
+void parseStatusFields(const char *buf, size_t length, uid_t &uid, double &rssKB,
+                       unsigned long long &voluntary, unsigned long long &involuntary)
+{
+    const char *end = buf + length;
+    for (const char *line = buf; line < end;)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (!lineEnd)
+            lineEnd = end;
+
+        if (lineEnd - line > 5 && memcmp(line, "Uid:", 4) == 0)
+        {
+            // "Uid:\t<real>\t<effective>..." - the real uid is the owner
+            if (from_chars(line + 5, lineEnd, uid).ec != errc())
+                uid = (uid_t)-1;
+        }
+        else if (lineEnd - line > 7 && memcmp(line, "VmRSS:", 6) == 0)
+        {
+            const char *value = line + 6;
+            while (value < lineEnd && (*value == ' ' || *value == '\t'))
+                value++;
+            long kB = 0;
+            from_chars(value, lineEnd, kB);
+            rssKB = kB;
+        }
+        else if (lineEnd - line > 25 && memcmp(line, "voluntary_ctxt_switches:", 24) == 0)
+        {
+            from_chars(line + 25, lineEnd, voluntary);
+        }
+        else if (lineEnd - line > 28 && memcmp(line, "nonvoluntary_ctxt_switches:", 27) == 0)
+        {
+            from_chars(line + 28, lineEnd, involuntary);
+        }
+        line = lineEnd + 1;
+    }
+}
+
+// read_bytes and write_bytes out of a /proc/<pid>/io buffer
+void parseIoFields(const char *buf, size_t length, unsigned long long &readBytes, unsigned long long &writeBytes)
+{
+    const char *end = buf + length;
+    for (const char *line = buf; line < end;)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (!lineEnd)
+            lineEnd = end;
+
+        if (lineEnd - line > 12 && memcmp(line, "read_bytes: ", 12) == 0)
+            from_chars(line + 12, lineEnd, readBytes);
+        else if (lineEnd - line > 13 && memcmp(line, "write_bytes: ", 13) == 0)
+            from_chars(line + 13, lineEnd, writeBytes);
+        line = lineEnd + 1;
+    }
+}
+
+// Pss and Swap (kB) out of a /proc/<pid>/smaps_rollup buffer
+void parseSmapsRollup(const char *buf, size_t length, double &pssKB, double &swapKB)
+{
+    const char *end = buf + length;
+    for (const char *line = buf; line < end;)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (!lineEnd)
+            lineEnd = end;
+
+        double *target = nullptr;
+        const char *value = nullptr;
+        if (lineEnd - line > 4 && memcmp(line, "Pss:", 4) == 0)
+            target = &pssKB, value = line + 4;
+        else if (lineEnd - line > 5 && memcmp(line, "Swap:", 5) == 0)
+            target = &swapKB, value = line + 5;
+        if (target)
+        {
+            while (value < lineEnd && *value == ' ')
+                value++;
+            long kB = 0;
+            from_chars(value, lineEnd, kB);
+            *target = kB;
+        }
+        line = lineEnd + 1;
+    }
+}
+
+int getCpuCount()
+{
+    ifstream cpuinfo(procRoot + "/cpuinfo");
+    string line;
+    int cpuCount = 0;
+
+    while (getline(cpuinfo, line))
+    {
+        if (line.find("processor") == 0)
+        {
+            cpuCount++;
+        }
+    }
+    return cpuCount > 0 ? cpuCount : 1;
+}
+
+// the columns a view can show, as bits. the table only reads the /proc files
+// behind the columns that the visible view, sort key and filters need.
+enum ColumnMask : unsigned
+{
+    ColumnPid = 1 << 0,
+    ColumnPpid = 1 << 1,
+    ColumnName = 1 << 2,
+    ColumnOwner = 1 << 3,  // needs status
+    ColumnMemory = 1 << 4, // needs statm, or status when the owner is read anyway
+    ColumnCpu = 1 << 5,
+    ColumnState = 1 << 6,
+    ColumnPriority = 1 << 7,
+    ColumnIo = 1 << 8,      // needs io; not shown, only sampled into the history
+    ColumnHistory = 1 << 9, // CPU sparkline, from the history ring buffer
+    // optional columns, off by default
+    ColumnIoRead = 1 << 10, // bytes/s, from io
+    ColumnIoWrite = 1 << 11,
+    ColumnPss = 1 << 12, // from smaps_rollup, which walks every mapping of the process
+    ColumnSwap = 1 << 13,
+    ColumnVoluntary = 1 << 14, // context switches/s, from status
+    ColumnInvoluntary = 1 << 15,
+    ColumnSchedWait = 1 << 16, // run queue wait in ms/s, from schedstat
+    ColumnsFromStat = ColumnPid | ColumnPpid | ColumnName | ColumnCpu | ColumnState | ColumnPriority, // stat is always read
+    ColumnsDefault = ColumnsFromStat | ColumnOwner | ColumnMemory | ColumnHistory,
+    ColumnsExtra = ColumnIoRead | ColumnIoWrite | ColumnPss | ColumnSwap | ColumnVoluntary | ColumnInvoluntary | ColumnSchedWait,
+    ColumnsAll = ColumnsDefault | ColumnsExtra,
+};
+
+// the values behind the optional columns, in ColumnsExtra bit order
+enum ExtraMetric
+{
+    MetricIoRead,
+    MetricIoWrite,
+    MetricPss,
+    MetricSwap,
+    MetricVoluntary,
+    MetricInvoluntary,
+    MetricSchedWait,
+    ExtraMetricCount
+};
+
+unsigned extraMetricColumn(int metric) { return ColumnIoRead << metric; }
+
+// machine-wide values every process in a snapshot needs. filled once at the
+// start of a refresh and passed to each Process, so the per-pid reads only
+// touch that pid's own files.
+struct SystemContext
+{
+    double totalMemoryKB = 0.0;          // MemTotal from /proc/meminfo
+    double uptimeSeconds = 0.0;          // first field of /proc/uptime
+    long clockTicks;                     // jiffies per second
+    int cpuCount;                        // online cpus
+    long long bootTime = 0;              // btime from /proc/stat, seconds since the epoch
+    unsigned long long totalJiffies = 0; // sum of the "cpu" line of /proc/stat
+    long pageSizeKB;                     // for statm, which counts pages
+
+    SystemContext() : clockTicks(sysconf(_SC_CLK_TCK)), cpuCount(getCpuCount()), pageSizeKB(sysconf(_SC_PAGESIZE) / 1024) {}
+
+    void load()
+    {
+        ifstream meminfo(procRoot + "/meminfo");
+        string label;
+        meminfo >> label >> totalMemoryKB; // MemTotal is the first line
+
+        ifstream uptimeFile(procRoot + "/uptime");
+        uptimeFile >> uptimeSeconds;
+
+        ifstream statFile(procRoot + "/stat");
+        string line;
+        totalJiffies = 0;
+        while (getline(statFile, line))
+        {
+            if (line.compare(0, 4, "cpu ") == 0)
+            {
+                // user nice system idle iowait irq softirq steal (guest time is already part of user)
+                stringstream ss(line.substr(4));
+                unsigned long long value = 0;
+                for (int i = 0; i < 8 && ss >> value; i++)
+                    totalJiffies += value;
+            }
+            else if (line.compare(0, 6, "btime ") == 0)
+            {
+                bootTime = stoll(line.substr(6));
+            }
+        }
+    }
+};
+
+// keeps the machine-wide jiffies of the previous snapshot, so per-process
+// utime/stime deltas can be turned into a CPU% over the last refresh
+// interval instead of a lifetime average
+class CpuSampler
+{
+private:
+    int cpuCount = 1;
+    unsigned long long prevTotal = 0;
+    unsigned long long totalDelta = 0; // jiffies elapsed on all cpus since the previous sample
+
+public:
+    void sample(const SystemContext &context)
+    {
+        cpuCount = context.cpuCount;
+        unsigned long long total = context.totalJiffies;
+        totalDelta = (prevTotal > 0 && total > prevTotal) ? total - prevTotal : 0;
+        prevTotal = total;
+    }
+
+    // false until two samples have been taken
+    bool hasInterval() const { return totalDelta > 0; }
+    int getCpuCount() const { return cpuCount; }
+
+    // share of one core, 100% per fully busy core (like top)
+    double perCorePercent(unsigned long long ticks) const
+    {
+        return hasInterval() ? 100.0 * ticks * cpuCount / totalDelta : 0.0;
+    }
+
+    // share of the whole machine, 0-100%
+    double normalizedPercent(unsigned long long ticks) const
+    {
+        return hasInterval() ? 100.0 * ticks / totalDelta : 0.0;
+    }
+};
+
+// hands out a small integer id per distinct string, so per-process fields
+// that repeat a lot (like the owner) are stored as an id instead of a copy
+class StringInterner
+{
+private:
+    vector<string> strings;
+    unordered_map<string, uint32_t> ids;
+
+public:
+    uint32_t intern(const string &value)
+    {
+        auto it = ids.find(value);
+        if (it != ids.end())
+            return it->second;
+        uint32_t id = strings.size();
+        strings.push_back(value);
+        ids.emplace(value, id);
+        return id;
+    }
+
+    const string &get(uint32_t id) const { return strings[id]; }
+    size_t size() const { return strings.size(); }
+};
+
+// uid -> interned user name cache. getpwuid() can go out to NSS/LDAP, so each
+// uid is looked up once and then served from an open-addressing table until
+// its entry is older than the ttl (0 keeps entries forever). reload() refills
+// the whole table from /etc/passwd in one pass.
+class UserCache
+{
+private:
+    struct Slot
+    {
+        uid_t uid;
+        uint32_t nameId;
+        chrono::steady_clock::time_point fetchedAt;
+        bool used;
+    };
+
+    vector<Slot> slots; // power-of-two sized, linear probing
+    size_t usedSlots = 0;
+    StringInterner names;
+    chrono::seconds ttl{0};
+    size_t hits = 0;
+    size_t misses = 0;
+
+    size_t slotIndex(uid_t uid) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t index = (uid * 2654435761u) & mask; // multiplicative hash, uids are often sequential
+        while (slots[index].used && slots[index].uid != uid)
+            index = (index + 1) & mask;
+        return index;
+    }
+
+    void grow()
+    {
+        vector<Slot> old = std::move(slots);
+        slots.assign(old.size() * 2, Slot{0, 0, {}, false});
+        for (const Slot &slot : old)
+            if (slot.used)
+                slots[slotIndex(slot.uid)] = slot;
+    }
+
+    void store(uid_t uid, uint32_t nameId)
+    {
+        if ((usedSlots + 1) * 10 > slots.size() * 7) // keep the load factor under 70%
+            grow();
+        Slot &slot = slots[slotIndex(uid)];
+        if (!slot.used)
+            usedSlots++;
+        slot = Slot{uid, nameId, chrono::steady_clock::now(), true};
+    }
+
+public:
+    UserCache() : slots(64, Slot{0, 0, {}, false})
+    {
+        names.intern("N/A");     // id 0: no status file
+        names.intern("unknown"); // id 1: uid without a passwd entry
+    }
+
+    static const uint32_t NotAvailable = 0;
+    static const uint32_t Unknown = 1;
+
+    uint32_t lookup(uid_t uid)
+    {
+        Slot &slot = slots[slotIndex(uid)];
+        if (slot.used && (ttl.count() == 0 || chrono::steady_clock::now() - slot.fetchedAt < ttl))
+        {
+            hits++;
+            return slot.nameId;
+        }
+
+        misses++;
+        struct passwd *pw = getpwuid(uid); // get the user's name
+        uint32_t nameId = pw != nullptr ? names.intern(pw->pw_name) : Unknown;
+        store(uid, nameId);
+        return nameId;
+    }
+
+    // batch-fill from /etc/passwd (name:password:uid:...); returns the number of users read
+    size_t reload()
+    {
+        ifstream passwdFile("/etc/passwd");
+        string line;
+        size_t count = 0;
+        while (getline(passwdFile, line))
+        {
+            size_t nameEnd = line.find(':');
+            size_t uidStart = nameEnd == string::npos ? string::npos : line.find(':', nameEnd + 1);
+            if (uidStart == string::npos)
+                continue;
+            uid_t uid = 0;
+            const char *begin = line.data() + uidStart + 1;
+            if (from_chars(begin, line.data() + line.size(), uid).ec != errc())
+                continue;
+            store(uid, names.intern(line.substr(0, nameEnd)));
+            count++;
+        }
+        return count;
+    }
+
+    void clear()
+    {
+        slots.assign(64, Slot{0, 0, {}, false});
+        usedSlots = 0;
+    }
+
+    const string &name(uint32_t nameId) const { return names.get(nameId); }
+    uint32_t intern(const string &name) { return names.intern(name); } // owners that do not come from a uid (replayed captures)
+    void setTtl(chrono::seconds seconds) { ttl = seconds; }
+    chrono::seconds getTtl() const { return ttl; }
+    size_t size() const { return usedSlots; }
+    size_t getHits() const { return hits; }
+    size_t getMisses() const { return misses; }
+};
+
+UserCache userCache; // shared by every Process
+
 class Process
 {
 private:
-    int pid;
-    string name;
-    int priority;
-    double memoryUsage;
-    string status;
-    string owner;
-    int ppid;
-    unsigned long utimeCurrent;
-    unsigned long stimeCurrent;
-    double cpuUsage;
-    static long clk_tck;
+    int pid;
+    int tgid = 0; // for a thread: its process, read from /proc/<tgid>/task/<pid>
+    string name;
+    int priority;
+    double memoryUsage;
+    double rssKB;
+    long threadCount;
+    unsigned long long ioBytes; // read_bytes + write_bytes so far
+    bool ioDenied = false;      // io of other users' processes needs ptrace access
+    bool smapsDenied = false;   // same for smaps_rollup
+
+    // optional columns, see ExtraMetric. the rate ones are computed from the
+    // cumulative counters of this and the previous refresh.
+    double extras[ExtraMetricCount] = {};
+    unsigned long long counters[ExtraMetricCount] = {};
+    unsigned long long prevCounters[ExtraMetricCount] = {};
+    double countersTime = 0; // uptime when the counters were read
+    double prevCountersTime = 0;
+    string status;
+    uid_t uid;
+    uint32_t ownerId; // interned name in userCache
+    int ppid;
+    unsigned long utimeCurrent;
+    unsigned long stimeCurrent;
+    double cpuUsage;           // per-core CPU% over the last refresh interval
+    double cpuUsageNormalized; // same, divided by the number of cpus
+    unsigned long prevUtime;   // utime/stime at the previous refresh
+    unsigned long prevStime;
+    bool hasPrevSample;        // false for processes seen for the first time
+    unsigned long long startTime; // 22nd field of stat, together with the pid it identifies the process
+    ChangeKind changeKind;
+    bool loaded; // false if the stat file was gone by the time we read it
+
+    // fd cache: /proc/<pid> plus its stat and status stay open between
+    // refreshes and are re-read with pread(), -1 when not cached
+    int dirFd = -1;
+    int statFd = -1;
+    int statusFd = -1;
+    int statmFd = -1;
+    int ioFd = -1;
+    int smapsFd = -1;
+    int schedstatFd = -1;
+    unsigned loadedColumns = 0; // ColumnMask bits valid for this snapshot
+
+    // interned cgroup v2 path, read once and kept until the pid is reused
+    uint32_t cgroupId = NoCgroup;
+    unsigned long long cgroupStartTime = 0;
+
+    bool openCached(int &fd, const char *file)
+    {
+        if (dirFd < 0)
+        {
+            if (!fdBudget.acquire())
+                return false;
+            char path[PATH_MAX];
+            if (tgid)
+                snprintf(path, sizeof(path), "%s/%d/task/%d", procRoot.c_str(), tgid, pid);
+            else
+                snprintf(path, sizeof(path), "%s/%d", procRoot.c_str(), pid);
+            dirFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+            if (dirFd < 0)
+            {
+                fdBudget.release();
+                return false;
+            }
+        }
+        if (!fdBudget.acquire())
+            return false;
+        fd = openat(dirFd, file, O_RDONLY | O_CLOEXEC); // no path building or lookup from the root
+        procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+        if (fd < 0)
+        {
+            fdBudget.release();
+            return false;
+        }
+        return true;
+    }
+
+    static ssize_t preadAll(int fd, char *buf, size_t size)
+    {
+        ssize_t bytesRead = pread(fd, buf, size - 1, 0);
+        procReadCounters.reads.fetch_add(1, memory_order_relaxed);
+        if (bytesRead <= 0)
+            return -1;
+        procReadCounters.bytes.fetch_add(bytesRead, memory_order_relaxed);
+        buf[bytesRead] = '\0';
+        return bytesRead;
+    }
+
+    // reads one of this pid's files through the fd cache when it is on
+    ssize_t readCached(int &fd, const char *file, char *buf, size_t size)
+    {
+        auto start = chrono::steady_clock::now();
+        ssize_t bytesRead = readCachedUntimed(fd, file, buf, size);
+        scanReadNanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return bytesRead;
+    }
+
+    ssize_t readCachedUntimed(int &fd, const char *file, char *buf, size_t size)
+    {
+        if (prefetchedFiles)
+        {
+            const PrefetchedFiles &files = *prefetchedFiles;
+            for (int i = 0; i < files.count; i++)
+            {
+                if (strcmp(files.file[i], file) != 0)
+                    continue;
+                if (files.length[i] <= 0)
+                    break; // not read by the backend, read it here
+                size_t length = min<size_t>(files.length[i], size - 1);
+                memcpy(buf, files.data[i], length);
+                buf[length] = '\0';
+                return length;
+            }
+        }
+        if (fd >= 0)
+        {
+            ssize_t bytesRead = preadAll(fd, buf, size);
+            if (bytesRead > 0)
+                return bytesRead;
+            // the process behind the cached fds is gone. the pid may already
+            // belong to a new process, so drop the fds and try a fresh open.
+            closeCachedFds();
+        }
+        if (fdCacheEnabled && openCached(fd, file))
+            return preadAll(fd, buf, size);
+        return readProcFile(pid, file, buf, size, tgid);
+    }
+
+    int *fdSlot(const char *file)
+    {
+        if (strcmp(file, "stat") == 0)
+            return &statFd;
+        if (strcmp(file, "status") == 0)
+            return &statusFd;
+        if (strcmp(file, "statm") == 0)
+            return &statmFd;
+        return nullptr;
+    }
+
+    // everything beyond stat, each file only if a requested column needs it:
+    // status for the owner and context switches, statm for memory alone, io,
+    // smaps_rollup and schedstat for the optional columns. adds to loadedColumns.
+    void fetchOptional(const SystemContext &context, unsigned columns)
+    {
+        double memKB = -1;
+        if (columns & (ColumnOwner | ColumnVoluntary | ColumnInvoluntary))
+        {
+            char statusBuffer[8192];
+            ssize_t statusLength = readCached(statusFd, "status", statusBuffer, sizeof(statusBuffer));
+            if (statusLength > 0)
+                parseStatusFields(statusBuffer, statusLength, uid, memKB, counters[MetricVoluntary], counters[MetricInvoluntary]);
+        }
+        else if (columns & ColumnMemory)
+        {
+            // "size resident shared ..." in pages
+            char statmBuffer[256];
+            ssize_t statmLength = readCached(statmFd, "statm", statmBuffer, sizeof(statmBuffer));
+            const char *resident = statmLength > 0 ? (const char *)memchr(statmBuffer, ' ', statmLength) : nullptr;
+            long pages = 0;
+            if (resident && from_chars(resident + 1, statmBuffer + statmLength, pages).ec == errc())
+                memKB = (double)pages * context.pageSizeKB;
+        }
+
+        if ((columns & ColumnMemory) && memKB >= 0 && context.totalMemoryKB > 0)
+        {
+            rssKB = memKB;
+            memoryUsage = (memKB / context.totalMemoryKB) * 100.0;
+        }
+
+        if ((columns & (ColumnIo | ColumnIoRead | ColumnIoWrite)) && !ioDenied)
+        {
+            char ioBuffer[512];
+            ssize_t ioLength = readCached(ioFd, "io", ioBuffer, sizeof(ioBuffer));
+            if (ioLength > 0)
+            {
+                parseIoFields(ioBuffer, ioLength, counters[MetricIoRead], counters[MetricIoWrite]);
+                ioBytes = counters[MetricIoRead] + counters[MetricIoWrite];
+            }
+            else
+            {
+                ioDenied = true; // don't retry every refresh
+            }
+        }
+
+        if ((columns & (ColumnPss | ColumnSwap)) && !smapsDenied)
+        {
+            char smapsBuffer[2048];
+            ssize_t smapsLength = readCached(smapsFd, "smaps_rollup", smapsBuffer, sizeof(smapsBuffer));
+            if (smapsLength > 0)
+                parseSmapsRollup(smapsBuffer, smapsLength, extras[MetricPss], extras[MetricSwap]);
+            else
+                smapsDenied = true; // kernel threads have none, other users' need ptrace access
+        }
+
+        if (columns & ColumnSchedWait)
+        {
+            // "<ns on cpu> <ns waiting on a run queue> <timeslices>"
+            char schedBuffer[128];
+            ssize_t schedLength = readCached(schedstatFd, "schedstat", schedBuffer, sizeof(schedBuffer));
+            const char *wait = schedLength > 0 ? (const char *)memchr(schedBuffer, ' ', schedLength) : nullptr;
+            if (wait)
+                from_chars(wait + 1, schedBuffer + schedLength, counters[MetricSchedWait]);
+        }
+
+        countersTime = context.uptimeSeconds;
+        loadedColumns |= columns & ~ColumnsFromStat;
+    }
+
+    // per-second rates of the counter metrics, if both this and the previous
+    // refresh read them for the same process
+    void updateRates(unsigned previousColumns)
+    {
+        double seconds = countersTime - prevCountersTime;
+        for (int metric : {MetricIoRead, MetricIoWrite, MetricVoluntary, MetricInvoluntary, MetricSchedWait})
+        {
+            unsigned column = extraMetricColumn(metric);
+            bool comparable = hasPrevSample && seconds > 0 && (loadedColumns & previousColumns & column) &&
+                              counters[metric] >= prevCounters[metric];
+            extras[metric] = comparable ? (counters[metric] - prevCounters[metric]) / seconds : 0;
+        }
+        extras[MetricSchedWait] /= 1e6; // ns/s -> ms/s
+    }
+
+    // returns false if the stat file could not be read (the process is gone)
+    bool fetchProcessDetails(const SystemContext &context, unsigned columns)
+    {
+        bool statRead = false;
+        name = "N/A";
+        priority = 0;
+        memoryUsage = 0;
+        rssKB = 0;
+        threadCount = 0;
+        ioBytes = 0;
+        memcpy(prevCounters, counters, sizeof(counters));
+        prevCountersTime = countersTime;
+        memset(counters, 0, sizeof(counters));
+        memset(extras, 0, sizeof(extras));
+        status = '?';
+        uid = (uid_t)-1; // owner is resolved from the uid later, see resolveOwner()
+        ppid = 0;
+        cpuUsage = 0.0;
+        cpuUsageNormalized = 0.0;
+        unsigned long long previousStart = startTime;
+        startTime = 0;
+
+        char statBuffer[4096]; // a stat line is well under 1KB, even with a 64 byte comm
+        StatFields fields;
+        ssize_t statLength = readCached(statFd, "stat", statBuffer, sizeof(statBuffer));
+        if (statLength > 0 && parseStatLine(statBuffer, statLength, fields))
+        {
+            statRead = true;
+            name.assign(fields.comm, fields.commLength); // reuses the string's buffer on refresh
+            name.erase(remove(name.begin(), name.end(), ' '), name.end()); // Remove any spaces in the name
+            status.assign(1, fields.state);
+            ppid = fields.ppid;
+            utimeCurrent = fields.utime;
+            stimeCurrent = fields.stime;
+            priority = fields.priority;
+            threadCount = fields.numThreads;
+            startTime = fields.starttime;
+            if (startTime != previousStart) // a reused pid: the old process's permissions say nothing about this one
+                ioDenied = smapsDenied = false;
+
+            double totalCPUTime = utimeCurrent + stimeCurrent;                                     // calculate total CPU time used to know how much CPU time the process consumedd in user and kernel modes
+            double seconds = context.uptimeSeconds - (startTime / (double)context.clockTicks); // calculate the time since the process started
+            if (seconds > 0) // lifetime average, only used until we have a previous sample
+                cpuUsage = 100.0 * ((totalCPUTime / context.clockTicks) / seconds);
+        }
+
+        if (statRead)
+        {
+            loadedColumns = ColumnsFromStat;
+            fetchOptional(context, columns);
+        }
+        return statRead;
+    }
+
+public:
+    static bool fdCacheEnabled; // keep /proc fds open across refreshes
+    static const uint32_t NoCgroup = UINT32_MAX;
+
+    // columns: ColumnMask bits to load, the stat columns are always loaded.
+    // with a threadGroup, p is the tid of one of that process's threads.
+    Process(int p, const SystemContext &context, unsigned columns = ColumnsDefault, int threadGroup = 0)
+    {
+        pid = p;
+        tgid = threadGroup;
+        utimeCurrent = 0;
+        stimeCurrent = 0;
+        prevUtime = 0;
+        prevStime = 0;
+        hasPrevSample = false;
+        ownerId = UserCache::NotAvailable;
+        changeKind = ChangeKind::Added;
+        loaded = fetchProcessDetails(context, columns);
+    }
+
+    // load columns the last refresh skipped, without re-reading stat
+    void loadColumns(const SystemContext &context, unsigned columns)
+    {
+        unsigned missing = columns & ~loadedColumns & ~ColumnsFromStat;
+        if (missing)
+            fetchOptional(context, missing); // rates of newly loaded counters start at the next refresh
+    }
+
+    unsigned getLoadedColumns() const { return loadedColumns; }
+
+    // the files a refresh with these columns reads first, in the order it
+    // reads them: stat, then status or statm (same choice as fetchOptional())
+    static int mainFiles(unsigned columns, const char *files[PrefetchedFiles::MaxFiles])
+    {
+        int count = 0;
+        files[count++] = "stat";
+        if (columns & (ColumnOwner | ColumnVoluntary | ColumnInvoluntary))
+            files[count++] = "status";
+        else if (columns & ColumnMemory)
+            files[count++] = "statm";
+        return count;
+    }
+
+    // the cached fd of one of mainFiles(), -1 if it is not open
+    int cachedFd(const char *file)
+    {
+        int *fd = fdSlot(file);
+        return fd ? *fd : -1;
+    }
+
+    // take over an fd opened elsewhere (its fdBudget unit included), false if
+    // the cache is off or already holds that file
+    bool adoptFd(const char *file, int fd)
+    {
+        int *slot = fdSlot(file);
+        if (!fdCacheEnabled || !slot || *slot >= 0)
+            return false;
+        *slot = fd;
+        return true;
+    }
+
+    ~Process() { closeCachedFds(); }
+    Process(const Process &) = delete; // owns file descriptors
+    Process &operator=(const Process &) = delete;
+
+    void closeCachedFds()
+    {
+        for (int *fd : {&statFd, &statusFd, &statmFd, &ioFd, &smapsFd, &schedstatFd, &dirFd})
+        {
+            if (*fd < 0)
+                continue;
+            close(*fd);
+            procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+            fdBudget.release();
+            *fd = -1;
+        }
+    }
+
+    // re-read the process in place; returns false if the process has exited.
+    // changeKind is set to Changed if any of the displayed fields moved.
+    bool refresh(const SystemContext &context, unsigned columns = ColumnsDefault)
+    {
+        string oldName = name;
+        string oldStatus = status;
+        uid_t oldUid = uid;
+        int oldPpid = ppid;
+        int oldPriority = priority;
+        double oldMemory = memoryUsage;
+        unsigned long oldUtime = utimeCurrent;
+        unsigned long oldStime = stimeCurrent;
+        unsigned long long oldStart = startTime;
+        unsigned oldColumns = loadedColumns;
+
+        if (!fetchProcessDetails(context, columns))
+            return false;
+
+        prevUtime = oldUtime;
+        prevStime = oldStime;
+        hasPrevSample = startTime == oldStart; // a reused pid starts over
+        updateRates(oldColumns);
+
+        unsigned comparable = oldColumns & loadedColumns; // a column that was just hidden or shown is not a change
+        bool changed = name != oldName || status != oldStatus || ppid != oldPpid || priority != oldPriority ||
+                       ((comparable & ColumnOwner) && uid != oldUid) ||
+                       ((comparable & ColumnMemory) && memoryUsage != oldMemory) ||
+                       utimeCurrent != oldUtime || stimeCurrent != oldStime;
+        changeKind = changed ? ChangeKind::Changed : ChangeKind::None;
+        return true;
+    }
+
+    // turn the utime/stime delta since the previous refresh into CPU%.
+    // processes seen for the first time keep their lifetime average.
+    void updateCpuUsage(const CpuSampler &sampler)
+    {
+        if (!hasPrevSample || !sampler.hasInterval())
+        {
+            cpuUsageNormalized = cpuUsage / sampler.getCpuCount();
+            return;
+        }
+        unsigned long long current = (unsigned long long)utimeCurrent + stimeCurrent;
+        unsigned long long previous = (unsigned long long)prevUtime + prevStime;
+        unsigned long long ticks = current > previous ? current - previous : 0;
+        cpuUsage = sampler.perCorePercent(ticks);
+        cpuUsageNormalized = sampler.normalizedPercent(ticks);
+    }
+
+    // map the uid to a user name. not thread safe (getpwuid and the shared
+    // cache), so a parallel scan calls this from the merge step.
+    void resolveOwner()
+    {
+        ownerId = uid == (uid_t)-1 ? UserCache::NotAvailable : userCache.lookup(uid);
+    }
+
+    bool isLoaded() const { return loaded; }
+    void setChangeKind(ChangeKind kind) { changeKind = kind; }
+
+    bool hasCgroup() const { return cgroupId != NoCgroup && cgroupStartTime == startTime; }
+    uint32_t getCgroupId() const { return hasCgroup() ? cgroupId : NoCgroup; }
+    void setCgroup(uint32_t id)
+    {
+        cgroupId = id;
+        cgroupStartTime = startTime;
+    }
+
+    // threads share the owner and memory of their process, so those are
+    // copied from it instead of reading every thread's status
+    void inheritFrom(const Process &leader)
+    {
+        uid = leader.uid;
+        ownerId = leader.ownerId;
+        memoryUsage = leader.memoryUsage;
+        rssKB = leader.rssKB;
+    }
+
+    int getPID() const { return pid; }
+    int getThreadGroup() const { return tgid; }
+    const string &getName() const { return name; }
+    double getMemoryUsage() const { return memoryUsage; }
+    double getRssKB() const { return rssKB; }
+    long getThreadCount() const { return threadCount; }
+    unsigned long long getIoBytes() const { return ioBytes; }
+    double getExtra(int metric) const { return extras[metric]; }
+    const double *getExtras() const { return extras; }
+    const string &getOwner() const { return userCache.name(ownerId); }
+    uint32_t getOwnerId() const { return ownerId; }
+    uid_t getUid() const { return uid; }
+    int getParentPID() const { return ppid; }
+    const string &getStatus() const { return status; }
+    int getPriority() const { return priority; }
+    static bool normalizedCpu; // report CPU% of the whole machine instead of per core
+    double getCPUUsage() const { return normalizedCpu ? cpuUsageNormalized : cpuUsage; }
+    double getCPUUsagePerCore() const { return cpuUsage; }
+    double getCPUUsageNormalized() const { return cpuUsageNormalized; }
+    unsigned long long getStartTime() const { return startTime; }
+    ChangeKind getChangeKind() const { return changeKind; }
+};
+
+bool Process::normalizedCpu = false;
+bool Process::fdCacheEnabled = true;
+
+struct SnapshotDiff // pids that appeared, disappeared or changed in the last refresh
+{
+    vector<int> added;
+    vector<int> exited;
+    vector<int> changed;
+
+    void clear()
+    {
+        added.clear();
+        exited.clear();
+        changed.clear();
+    }
+};
+
+bool running = true;           // flag for controlling auto-refresh
+void signalHandler(int signum) // signal handler for Ctrl+C
+{
+    running = false;
+}
+
+bool isNumeric(const string &s)
+{
+    if (s.empty())
+    {
+        return false;
+    }
+    return std::all_of(s.begin(), s.end(), ::isdigit);
+}
+
+// isNumeric() and the value, false if it doesn't fit in T (where stoi throws)
+template <typename T>
+bool parseNumeric(const string &s, T &value)
+{
+    return isNumeric(s) && from_chars(s.data(), s.data() + s.size(), value).ec == errc();
+}
+
+// listens to the kernel proc connector (netlink, needs CAP_NET_ADMIN) for
+// fork/exec/exit events on a background thread. the table uses it to know
+// which pids exist without walking /proc, and it remembers processes that
+// were born and exited between two refreshes, which a scan never sees.
+class ProcEventSource
+{
+public:
+    struct ShortLived
+    {
+        int pid;
+        int ppid;
+        string name;
+        int exitCode;
+    };
+
+private:
+    int sock = -1;
+    thread reader;
+    atomic<bool> stopping{false};
+    atomic<size_t> eventCount{0};
+
+    mutable mutex pendingMutex; // guards everything below
+    vector<int> forked;         // processes (not threads) forked since the last drain
+    vector<int> exited;
+    unordered_map<int, ShortLived> born; // forked since the last drain, a refresh has not seen them yet
+    deque<ShortLived> shortLived;        // newest last
+    bool overflowed = false;
+
+    static const size_t MaxShortLived = 200;
+
+    bool sendControl(proc_cn_mcast_op op)
+    {
+        // nlmsghdr | cn_msg | proc_cn_mcast_op, laid out by hand because cn_msg ends in a flexible array
+        alignas(nlmsghdr) char request[NLMSG_SPACE(sizeof(cn_msg) + sizeof(proc_cn_mcast_op))];
+        memset(request, 0, sizeof(request));
+        nlmsghdr *header = (nlmsghdr *)request;
+        header->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(proc_cn_mcast_op));
+        header->nlmsg_pid = getpid();
+        header->nlmsg_type = NLMSG_DONE;
+        cn_msg *message = (cn_msg *)NLMSG_DATA(header);
+        message->id.idx = CN_IDX_PROC;
+        message->id.val = CN_VAL_PROC;
+        message->len = sizeof(proc_cn_mcast_op);
+        memcpy(message->data, &op, sizeof(op));
+        return send(sock, request, header->nlmsg_len, 0) == (ssize_t)header->nlmsg_len;
+    }
+
+    static string readComm(int pid)
+    {
+        char buffer[64];
+        ssize_t length = readProcFile(pid, "comm", buffer, sizeof(buffer));
+        if (length <= 0)
+            return "?";
+        if (buffer[length - 1] == '\n')
+            length--;
+        return string(buffer, length);
+    }
+
+    void handle(const proc_event &event)
+    {
+        eventCount++;
+        lock_guard<mutex> lock(pendingMutex);
+        switch (event.what)
+        {
+        case proc_event::PROC_EVENT_FORK:
+            if (event.event_data.fork.child_pid != event.event_data.fork.child_tgid)
+                return; // a new thread, not a process
+            forked.push_back(event.event_data.fork.child_tgid);
+            born[event.event_data.fork.child_tgid] = ShortLived{event.event_data.fork.child_tgid, event.event_data.fork.parent_tgid, "", 0};
+            break;
+        case proc_event::PROC_EVENT_EXEC:
+        {
+            auto it = born.find(event.event_data.exec.process_tgid);
+            if (it != born.end())
+                it->second.name = readComm(it->first); // grab the name while the process is still there
+            break;
+        }
+        case proc_event::PROC_EVENT_EXIT:
+        {
+            if (event.event_data.exit.process_pid != event.event_data.exit.process_tgid)
+                return; // a thread exiting
+            int pid = event.event_data.exit.process_tgid;
+            exited.push_back(pid);
+            auto it = born.find(pid);
+            if (it != born.end()) // born and gone before any refresh saw it
+            {
+                it->second.exitCode = event.event_data.exit.exit_code >> 8;
+                if (it->second.name.empty())
+                    it->second.name = "?";
+                shortLived.push_back(it->second);
+                if (shortLived.size() > MaxShortLived)
+                    shortLived.pop_front();
+                born.erase(it);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void readLoop()
+    {
+        alignas(nlmsghdr) char buffer[8192];
+        pollfd pfd = {sock, POLLIN, 0};
+        while (!stopping)
+        {
+            if (poll(&pfd, 1, 200) <= 0) // wake up now and then to check stopping
+                continue;
+            ssize_t length = recv(sock, buffer, sizeof(buffer), 0);
+            if (length < 0)
+            {
+                if (errno == ENOBUFS) // the kernel dropped events, only a full scan can recover
+                {
+                    lock_guard<mutex> lock(pendingMutex);
+                    overflowed = true;
+                }
+                continue;
+            }
+            for (nlmsghdr *header = (nlmsghdr *)buffer; NLMSG_OK(header, (size_t)length); header = NLMSG_NEXT(header, length))
+            {
+                if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
+                    continue;
+                cn_msg *message = (cn_msg *)NLMSG_DATA(header);
+                if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
+                    continue;
+                handle(*(proc_event *)message->data);
+            }
+        }
+    }
+
+public:
+    // subscribe to the connector; on failure error says why and nothing runs
+    bool start(string &error)
+    {
+        sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (sock < 0)
+        {
+            error = string("netlink socket: ") + strerror(errno);
+            return false;
+        }
+
+        int bufferSize = 4 << 20; // room for bursts of forks between two reads
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+        sockaddr_nl address;
+        memset(&address, 0, sizeof(address));
+        address.nl_family = AF_NETLINK;
+        address.nl_groups = CN_IDX_PROC;
+        address.nl_pid = 0; // let the kernel pick, so several instances can listen
+        if (::bind(sock, (sockaddr *)&address, sizeof(address)) < 0 || !sendControl(PROC_CN_MCAST_LISTEN))
+        {
+            error = string("proc connector: ") + strerror(errno) + (errno == EPERM ? " (needs CAP_NET_ADMIN)" : "");
+            close(sock);
+            sock = -1;
+            return false;
+        }
+
+        reader = thread(&ProcEventSource::readLoop, this);
+        return true;
+    }
+
+    ~ProcEventSource()
+    {
+        if (sock < 0)
+            return;
+        stopping = true;
+        reader.join();
+        sendControl(PROC_CN_MCAST_IGNORE);
+        close(sock);
+    }
+
+    // moves the pids forked/exited since the last call into the vectors.
+    // returns false if events were lost since then, so a full scan is needed.
+    bool drain(vector<int> &forkedOut, vector<int> &exitedOut)
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        forkedOut.swap(forked);
+        exitedOut.swap(exited);
+        forked.clear();
+        exited.clear();
+        born.clear();
+        bool complete = !overflowed;
+        overflowed = false;
+        return complete;
+    }
+
+    vector<ShortLived> getShortLived() const
+    {
+        lock_guard<mutex> lock(pendingMutex);
+        return vector<ShortLived>(shortLived.begin(), shortLived.end());
+    }
+
+    size_t getEventCount() const { return eventCount; }
+};
+
+// fixed set of worker threads that split a range of indexes in chunks. the
+// calling thread works on the range too, and run() returns once every chunk is
+// done, so callers can fill preallocated per-index slots without any locking.
+class WorkerPool
+{
+private:
+    vector<thread> workers;
+    mutex jobMutex;
+    condition_variable jobReady;
+    condition_variable jobDone;
+    function<void(size_t, size_t)> job;
+    size_t jobSize = 0;
+    size_t chunkSize = 1;
+    atomic<size_t> nextIndex{0};
+    size_t busyWorkers = 0;
+    unsigned long jobGeneration = 0;
+    bool stopping = false;
+
+    void runChunks()
+    {
+        while (true)
+        {
+            size_t begin = nextIndex.fetch_add(chunkSize);
+            if (begin >= jobSize)
+                return;
+            job(begin, min(begin + chunkSize, jobSize));
+        }
+    }
+
+    void workerLoop()
+    {
+        unsigned long seenGeneration = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(jobMutex);
+                jobReady.wait(lock, [&]
+                              { return stopping || jobGeneration != seenGeneration; });
+                if (stopping)
+                    return;
+                seenGeneration = jobGeneration;
+            }
+            runChunks();
+            {
+                lock_guard<mutex> lock(jobMutex);
+                if (--busyWorkers == 0)
+                    jobDone.notify_one();
+            }
+        }
+    }
+
+public:
+    // threadCount includes the calling thread, so 1 means no extra threads
+    explicit WorkerPool(size_t threadCount)
+    {
+        for (size_t i = 1; i < threadCount; i++)
+            workers.emplace_back(&WorkerPool::workerLoop, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            lock_guard<mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+    }
+
+    void run(size_t count, size_t chunk, const function<void(size_t, size_t)> &work)
+    {
+        if (workers.empty() || count <= chunk)
+        {
+            if (count > 0)
+                work(0, count);
+            return;
+        }
+        {
+            lock_guard<mutex> lock(jobMutex);
+            job = work;
+            jobSize = count;
+            chunkSize = chunk;
+            nextIndex = 0;
+            busyWorkers = workers.size();
+            jobGeneration++;
+        }
+        jobReady.notify_all();
+        runChunks();
+        unique_lock<mutex> lock(jobMutex);
+        jobDone.wait(lock, [&]
+                     { return busyWorkers == 0; });
+    }
+
+    size_t size() const { return workers.size() + 1; }
+};
+
+// per-process samples of the last `depth` refreshes, for sparklines and
+// rate queries. everything is allocated up front: maxProcesses slots of depth
+// samples each, indexed by refresh number, so long auto sessions never grow it.
+// processes beyond maxProcesses are simply not tracked.
+class ProcessHistory
+{
+public:
+    enum class Metric
+    {
+        Cpu,
+        Rss,
+        Io
+    };
+
+    struct Sample
+    {
+        float cpu; // CPU% over the refresh interval
+        uint32_t rssKB;
+        unsigned long long ioBytes; // read + written so far
+    };
+
+    struct WindowStats
+    {
+        double min = 0, max = 0, avg = 0;
+        double growth = 0;  // per second, from the first to the last sample
+        double seconds = 0; // what the window really covers
+        size_t samples = 0;
+    };
+
+private:
+    struct Slot
+    {
+        int pid;
+        unsigned long long startTime;
+        unsigned long firstTick; // first refresh with a sample in this slot
+    };
+
+    size_t depth;
+    size_t maxProcesses;
+    vector<Sample> samples; // maxProcesses * depth, one row per slot
+    vector<Slot> slots;
+    vector<uint32_t> freeSlots;
+    unordered_map<int, uint32_t> slotByPid;
+    vector<double> tickTimes; // seconds since origin, one per refresh in the ring
+    unsigned long ticks = 0;  // refreshes recorded so far
+    size_t untracked = 0;     // processes without a slot in the last refresh
+    chrono::steady_clock::time_point origin = chrono::steady_clock::now();
+
+    const Sample &sampleAt(uint32_t slot, unsigned long tick) const { return samples[slot * depth + tick % depth]; }
+
+    // the ticks of a slot that lie in the last `seconds` (all kept ones if 0)
+    bool window(uint32_t slot, double seconds, unsigned long &first, unsigned long &last) const
+    {
+        if (ticks == 0)
+            return false;
+        last = ticks - 1;
+        first = max(slots[slot].firstTick, ticks > depth ? ticks - depth : 0UL);
+        double now = tickTimes[last % depth];
+        while (seconds > 0 && first < last && now - tickTimes[first % depth] > seconds)
+            first++;
+        return true;
+    }
+
+    static double value(const Sample &sample, Metric metric)
+    {
+        switch (metric)
+        {
+        case Metric::Cpu:
+            return sample.cpu;
+        case Metric::Rss:
+            return sample.rssKB;
+        default:
+            return (double)sample.ioBytes;
+        }
+    }
+
+    bool slotFor(int pid, uint32_t &slot) const
+    {
+        auto it = slotByPid.find(pid);
+        if (it == slotByPid.end())
+            return false;
+        slot = it->second;
+        return true;
+    }
+
+public:
+    ProcessHistory(size_t depth, size_t maxProcesses)
+        : depth(max<size_t>(2, depth)), maxProcesses(maxProcesses),
+          samples(this->depth * maxProcesses), slots(maxProcesses), tickTimes(this->depth)
+    {
+        freeSlots.reserve(maxProcesses);
+        for (size_t slot = maxProcesses; slot-- > 0;)
+            freeSlots.push_back(slot);
+        slotByPid.reserve(maxProcesses); // no rehashing later either
+    }
+
+    // start a refresh: drop the slots of exited (or reused) pids
+    void beginTick(const SnapshotDiff &diff)
+    {
+        for (int pid : diff.exited)
+        {
+            auto it = slotByPid.find(pid);
+            if (it == slotByPid.end())
+                continue;
+            freeSlots.push_back(it->second);
+            slotByPid.erase(it);
+        }
+        tickTimes[ticks % depth] = chrono::duration<double>(chrono::steady_clock::now() - origin).count();
+        ticks++;
+        untracked = 0;
+    }
+
+    void record(const Process &proc)
+    {
+        uint32_t slot;
+        auto it = slotByPid.find(proc.getPID());
+        if (it != slotByPid.end() && slots[it->second].startTime == proc.getStartTime())
+        {
+            slot = it->second;
+        }
+        else
+        {
+            if (it != slotByPid.end()) // reused pid the diff did not report (e.g. first refresh)
+            {
+                freeSlots.push_back(it->second);
+                slotByPid.erase(it);
+            }
+            if (freeSlots.empty())
+            {
+                untracked++;
+                return;
+            }
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+            slots[slot] = Slot{proc.getPID(), proc.getStartTime(), ticks - 1};
+            slotByPid[proc.getPID()] = slot;
+        }
+        Sample &sample = samples[slot * depth + (ticks - 1) % depth];
+        sample.cpu = (float)proc.getCPUUsage();
+        sample.rssKB = (uint32_t)min(proc.getRssKB(), 4294967295.0);
+        sample.ioBytes = proc.getIoBytes();
+    }
+
+    // min/max/avg and growth over the last `seconds` (0: everything kept).
+    // for io, min/max/avg are of the bytes/s between samples.
+    bool stats(int pid, Metric metric, double seconds, WindowStats &result) const
+    {
+        uint32_t slot;
+        unsigned long first, last;
+        if (!slotFor(pid, slot) || !window(slot, seconds, first, last))
+            return false;
+
+        result = WindowStats();
+        result.seconds = tickTimes[last % depth] - tickTimes[first % depth];
+        double sum = 0;
+        for (unsigned long tick = first; tick <= last; tick++)
+        {
+            double current = value(sampleAt(slot, tick), metric);
+            if (metric == Metric::Io)
+            {
+                if (tick == first)
+                    continue;
+                double dt = tickTimes[tick % depth] - tickTimes[(tick - 1) % depth];
+                current = dt > 0 ? (current - value(sampleAt(slot, tick - 1), metric)) / dt : 0;
+            }
+            result.min = result.samples == 0 ? current : min(result.min, current);
+            result.max = result.samples == 0 ? current : max(result.max, current);
+            sum += current;
+            result.samples++;
+        }
+        if (result.samples)
+            result.avg = sum / result.samples;
+        if (result.seconds > 0)
+            result.growth = (value(sampleAt(slot, last), metric) - value(sampleAt(slot, first), metric)) / result.seconds;
+        return true;
+    }
+
+    // the k processes whose metric grew fastest over the last `seconds`
+    // (for io: the highest throughput)
+    vector<pair<int, double>> topGrowth(Metric metric, double seconds, size_t k) const
+    {
+        vector<pair<int, double>> rates;
+        rates.reserve(slotByPid.size());
+        WindowStats window;
+        for (const auto &[pid, slot] : slotByPid)
+            if (stats(pid, metric, seconds, window) && window.seconds > 0)
+                rates.push_back({pid, window.growth});
+        k = min(k, rates.size());
+        partial_sort(rates.begin(), rates.begin() + k, rates.end(), [](const auto &a, const auto &b)
+                     { return a.second > b.second; });
+        rates.resize(k);
+        return rates;
+    }
+
+    // the last `width` samples as block characters, oldest first, padded
+    // with spaces on the left while there is less history than that
+    string sparkline(int pid, Metric metric, size_t width) const
+    {
+        static const char *const blocks[] = {"\u2581", "\u2582", "\u2583", "\u2584", "\u2585", "\u2586", "\u2587", "\u2588"};
+        uint32_t slot;
+        unsigned long first, last;
+        if (!slotFor(pid, slot) || !window(slot, 0, first, last) || width == 0)
+            return string(width, ' ');
+        unsigned long recordedFirst = first;
+        if (metric == Metric::Io && first < last)
+            first++; // io is drawn as the bytes moved per interval
+        if (last - first + 1 > width)
+            first = last - width + 1;
+
+        double values[256] = {};
+        size_t count = 0;
+        for (unsigned long tick = first; tick <= last && count < 256; tick++)
+        {
+            double current = value(sampleAt(slot, tick), metric);
+            if (metric == Metric::Io) // nothing moved yet on the first recorded tick
+                current = tick > recordedFirst ? current - value(sampleAt(slot, tick - 1), metric) : 0;
+            values[count++] = current;
+        }
+        // cpu and io from zero, rss between its own min and max so growth shows
+        double low = metric == Metric::Rss ? *min_element(values, values + count) : 0;
+        double high = *max_element(values, values + count);
+        if (metric == Metric::Cpu)
+            high = max(high, 1.0); // idle processes stay flat
+        string line(width - count, ' ');
+        for (size_t i = 0; i < count; i++)
+        {
+            int level = high > low ? (int)((values[i] - low) / (high - low) * 7 + 0.5) : 0;
+            line += blocks[level];
+        }
+        return line;
+    }
+
+    size_t getDepth() const { return depth; }
+    size_t getMaxProcesses() const { return maxProcesses; }
+    size_t getTracked() const { return slotByPid.size(); }
+    size_t getUntracked() const { return untracked; }
+    size_t memoryBytes() const { return samples.size() * sizeof(Sample) + slots.size() * sizeof(Slot) + tickTimes.size() * sizeof(double); }
+};
+
+// parent -> children index over the table's pids. the table keeps it up to
+// date from each refresh's diff instead of it being rebuilt per command, and
+// subtree totals are filled in by one post-order pass when they are asked for.
+class ProcessTree
+{
+public:
+    struct Totals
+    {
+        double cpu = 0;     // CPU% of the process and all its descendants
+        double rssKB = 0;
+        long threads = 0;
+        size_t processes = 0;
+    };
+
+private:
+    struct Node
+    {
+        const Process *process;
+        int ppid;
+        Totals totals;
+    };
+
+    unordered_map<int, Node> nodes;
+    unordered_map<int, vector<int>> childrenOf; // by ppid, also for ppids not (or no longer) in the table
+    vector<int> noChildren;
+    bool totalsValid = false;
+
+    void unlink(int pid, int ppid)
+    {
+        auto it = childrenOf.find(ppid);
+        if (it == childrenOf.end())
+            return;
+        vector<int> &siblings = it->second;
+        auto found = find(siblings.begin(), siblings.end(), pid);
+        if (found != siblings.end())
+        {
+            *found = siblings.back(); // order does not matter, children() callers sort
+            siblings.pop_back();
+        }
+        if (siblings.empty())
+            childrenOf.erase(it);
+    }
+
+public:
+    void insert(const Process &proc)
+    {
+        nodes[proc.getPID()] = Node{&proc, proc.getParentPID(), Totals()};
+        childrenOf[proc.getParentPID()].push_back(proc.getPID());
+        totalsValid = false;
+    }
+
+    void remove(int pid)
+    {
+        auto it = nodes.find(pid);
+        if (it == nodes.end())
+            return;
+        unlink(pid, it->second.ppid);
+        nodes.erase(it);
+        // its children stay filed under this pid until a refresh sees them reparented
+        totalsValid = false;
+    }
+
+    // the process was refreshed in place: follow a ppid change (reparenting)
+    void update(const Process &proc)
+    {
+        auto it = nodes.find(proc.getPID());
+        if (it == nodes.end())
+        {
+            insert(proc);
+            return;
+        }
+        if (it->second.ppid != proc.getParentPID())
+        {
+            unlink(proc.getPID(), it->second.ppid);
+            it->second.ppid = proc.getParentPID();
+            childrenOf[proc.getParentPID()].push_back(proc.getPID());
+        }
+        totalsValid = false;
+    }
+
+    void invalidate() { totalsValid = false; } // cpu and memory change on every refresh
+
+    bool contains(int pid) const { return nodes.count(pid) != 0; }
+
+    // direct children, in no particular order
+    const vector<int> &children(int pid) const
+    {
+        auto it = childrenOf.find(pid);
+        return it == childrenOf.end() ? noChildren : it->second;
+    }
+
+    // processes whose parent is not in the table (pid 1, kthreadd, and
+    // anything whose parent exited before it was reparented)
+    vector<int> roots() const
+    {
+        vector<int> result;
+        for (const auto &[pid, node] : nodes)
+            if (!nodes.count(node.ppid) || node.ppid == pid)
+                result.push_back(pid);
+        sort(result.begin(), result.end());
+        return result;
+    }
+
+    // one iterative post-order pass over every root; each node's totals are
+    // its own values plus its children's totals
+    void computeTotals()
+    {
+        if (totalsValid)
+            return;
+        vector<pair<int, bool>> stack; // pid, children already pushed
+        for (int root : roots())
+        {
+            stack.push_back({root, false});
+            while (!stack.empty())
+            {
+                auto [pid, expanded] = stack.back();
+                Node &node = nodes[pid];
+                if (!expanded)
+                {
+                    stack.back().second = true;
+                    for (int child : children(pid))
+                        if (child != pid && nodes.count(child))
+                            stack.push_back({child, false});
+                    continue;
+                }
+                stack.pop_back();
+                node.totals.cpu = node.process->getCPUUsage();
+                node.totals.rssKB = node.process->getRssKB();
+                node.totals.threads = node.process->getThreadCount();
+                node.totals.processes = 1;
+                for (int child : children(pid))
+                {
+                    if (child == pid || !nodes.count(child))
+                        continue;
+                    const Totals &childTotals = nodes[child].totals;
+                    node.totals.cpu += childTotals.cpu;
+                    node.totals.rssKB += childTotals.rssKB;
+                    node.totals.threads += childTotals.threads;
+                    node.totals.processes += childTotals.processes;
+                }
+            }
+        }
+        totalsValid = true;
+    }
+
+    // call computeTotals() first
+    const Totals &totals(int pid) const
+    {
+        static const Totals none;
+        auto it = nodes.find(pid);
+        return it == nodes.end() ? none : it->second.totals;
+    }
+
+    size_t size() const { return nodes.size(); }
+};
+
+// where the cgroup v2 hierarchy is mounted (/sys/fs/cgroup, or
+// /sys/fs/cgroup/unified on hybrid setups), from our own mountinfo. empty if
+// there is none, then only the per-process sums are shown.
+const string &cgroupMount()
+{
+    static string mount;
+    static bool looked = false;
+    if (looked)
+        return mount;
+    looked = true;
+    ifstream mountinfo("/proc/self/mountinfo");
+    string line;
+    while (getline(mountinfo, line))
+    {
+        // "36 25 0:31 / /sys/fs/cgroup/unified rw,... shared:10 - cgroup2 cgroup2 rw"
+        size_t separator = line.find(" - ");
+        if (separator == string::npos || line.compare(separator + 3, 8, "cgroup2 ") != 0)
+            continue;
+        stringstream fields(line.substr(0, separator));
+        string id, parent, device, root, mountPoint;
+        fields >> id >> parent >> device >> root >> mountPoint;
+        mount = mountPoint;
+        break;
+    }
+    return mount;
+}
+
+// the cgroup v2 path of a process, the "0::" line of /proc/<pid>/cgroup
+bool readCgroupPath(int pid, string &path)
+{
+    char buffer[4096];
+    ssize_t length = readProcFile(pid, "cgroup", buffer, sizeof(buffer));
+    if (length <= 0)
+        return false;
+    const char *line = buffer;
+    const char *end = buffer + length;
+    while (line < end)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (!lineEnd)
+            lineEnd = end;
+        if (lineEnd - line >= 3 && memcmp(line, "0::", 3) == 0)
+        {
+            path.assign(line + 3, lineEnd);
+            return true;
+        }
+        line = lineEnd + 1;
+    }
+    return false;
+}
+
+// one cgroup's own accounting: cpu.stat, memory.current and io.stat, read
+// once per cgroup per refresh however many processes it holds
+struct CgroupUsage
+{
+    unsigned long long cpuUsec = 0; // usage_usec of cpu.stat
+    unsigned long long ioBytes = 0; // rbytes + wbytes of every device in io.stat
+    double memoryBytes = -1;        // memory.current, -1 where the memory controller is off
+    double cpuPercent = -1;         // over the last refresh, -1 until there are two samples
+    double ioRate = -1;             // bytes/s, same
+    double sampledAt = 0;           // steady clock seconds, 0: never read
+    unsigned long generation = 0;   // last refresh that had a process in it
+
+    static ssize_t readFile(const string &path, char *buf, size_t size)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+        if (fd < 0)
+            return -1;
+        ssize_t bytesRead = read(fd, buf, size - 1);
+        close(fd);
+        procReadCounters.reads.fetch_add(1, memory_order_relaxed);
+        procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+        if (bytesRead < 0)
+            return -1;
+        procReadCounters.bytes.fetch_add(bytesRead, memory_order_relaxed);
+        buf[bytesRead] = '\0';
+        return bytesRead;
+    }
+
+    void sample(const string &path, double now, int cpuCount)
+    {
+        const string &mount = cgroupMount();
+        if (mount.empty())
+            return;
+        string directory = mount + (path == "/" ? "" : path) + "/";
+        char buffer[4096];
+
+        bool hasCpu = false;
+        unsigned long long cpu = 0;
+        ssize_t length = readFile(directory + "cpu.stat", buffer, sizeof(buffer));
+        const char *usage = length > 0 ? strstr(buffer, "usage_usec ") : nullptr;
+        if (usage)
+            hasCpu = from_chars(usage + 11, buffer + length, cpu).ec == errc();
+
+        memoryBytes = -1;
+        length = readFile(directory + "memory.current", buffer, sizeof(buffer));
+        unsigned long long memory = 0;
+        if (length > 0 && from_chars(buffer, buffer + length, memory).ec == errc())
+            memoryBytes = memory;
+
+        // "8:0 rbytes=1234 wbytes=5678 rios=1 wios=2 dbytes=0 dios=0" per device
+        bool hasIo = false;
+        unsigned long long io = 0;
+        length = readFile(directory + "io.stat", buffer, sizeof(buffer));
+        for (const char *field = buffer; length > 0 && (field = strstr(field, "bytes=")) != nullptr; field += 6)
+        {
+            if (field - buffer < 1 || (field[-1] != 'r' && field[-1] != 'w'))
+                continue; // dbytes
+            unsigned long long bytes = 0;
+            from_chars(field + 6, buffer + length, bytes);
+            io += bytes;
+            hasIo = true;
+        }
+
+        double seconds = now - sampledAt;
+        bool comparable = sampledAt > 0 && seconds > 0;
+        cpuPercent = hasCpu && comparable && cpu >= cpuUsec ? 100.0 * (cpu - cpuUsec) / (seconds * 1e6) : -1;
+        if (cpuPercent >= 0 && Process::normalizedCpu)
+            cpuPercent /= cpuCount;
+        ioRate = hasIo && comparable && io >= ioBytes ? (io - ioBytes) / seconds : -1;
+        cpuUsec = cpu;
+        ioBytes = io;
+        sampledAt = now;
+    }
+};
+
+// persistent process table keyed by pid. a refresh only allocates a Process for
+// pids we have not seen before, updates the rest in place and drops the ones
+// that exited. a pid whose start time changed was reused by the kernel and is
+// reported as one exit plus one addition.
+class ProcessTable
+{
+private:
+    struct Entry
+    {
+        unique_ptr<Process> process;
+        unsigned long seenGeneration; // last refresh that found this pid in /proc
+    };
+
+    // one per pid found by readdir. workers only write to their own slot;
+    // the table itself is only modified by the merge on the calling thread.
+    struct ScanSlot
+    {
+        int pid;                      // the tid for a thread
+        int tgid;                     // 0 for a process
+        Process *existing;            // entry from the previous refresh, updated in place
+        unique_ptr<Process> created;  // new pid, allocated by the worker
+        unsigned long long oldStart;
+        bool alive;
+    };
+
+    // a process whose threads are listed. the task directory stays open and
+    // is rewound on every refresh, tids keeps its storage.
+    struct TaskDir
+    {
+        int fd = -1;
+        vector<int> tids;
+        unsigned long seenGeneration = 0;
+
+        TaskDir() = default;
+        TaskDir(const TaskDir &) = delete;
+        ~TaskDir() { close(); }
+
+        void close()
+        {
+            if (fd < 0)
+                return;
+            ::close(fd);
+            procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+            fdBudget.release();
+            fd = -1;
+        }
+    };
+
+    unordered_map<int, Entry> entries;
+    vector<int> pids;
+    vector<ScanSlot> slots; // kept between refreshes so its storage is reused
+    int procDirFd = -1;     // procRoot, kept open and rewound like the task directories
+
+    // thread view: the processes in threadPids (every process with
+    // threadsAll) are also read per task, into threads
+    bool threadsEnabled = false;
+    bool threadsAll = false;
+    vector<int> threadPids; // sorted
+    unordered_map<int, TaskDir> taskDirs; // by pid
+    unordered_map<int, Entry> threads;    // by tid
+    vector<pair<int, TaskDir *>> taskDirList;
+    vector<ScanSlot> threadSlots;
+    unsigned long threadsSince = 0; // generation of the first refresh with the current selection
+
+    // cgroup grouping, off until it is first asked for. each process keeps
+    // its cgroup, and every cgroup with a process in it is sampled once per refresh.
+    bool cgroupsEnabled = false;
+    StringInterner cgroupPaths;
+    vector<CgroupUsage> cgroupUsage; // by cgroup id
+    unique_ptr<ProcEventSource> events; // null: every refresh walks /proc
+    bool ioUringEnabled = false;        // read stat/status through io_uring, see prefetchChunk()
+    vector<int> forkedPids;
+    vector<int> exitedPids;
+    size_t fullScans = 0;
+    bool fullScanPending = false; // walk /proc on the next refresh, e.g. right after enableEvents()
+    size_t eventScans = 0;
+    SnapshotDiff diff;
+    SystemContext context;
+    CpuSampler cpuSampler;
+    unique_ptr<WorkerPool> pool;
+    unsigned long generation = 0;
+    unsigned columns = ColumnsDefault; // ColumnMask of what refreshes read
+    unsigned requestedColumns = ColumnsDefault;
+    ProcessTree tree;
+    unique_ptr<ProcessHistory> history; // null: no history kept
+
+    static const size_t ScanChunk = 64;      // pids per work item
+    static const unsigned long FullScanEvery = 10; // with events: walk /proc on every 10th refresh anyway
+
+    bool listProcDirectory(vector<int> &pids)
+    {
+        if (procDirFd < 0)
+        {
+            procDirFd = open(procRoot.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+        }
+        if (procDirFd < 0 || !listNumericEntries(procDirFd, pids))
+        {
+            cout << "Error opening " << procRoot << " directory" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // the tids of one process, false if it is gone. without room in the fd
+    // budget the directory is opened for this refresh only.
+    static bool listTaskDir(int pid, TaskDir &dir)
+    {
+        dir.tids.clear();
+        if (dir.fd < 0)
+        {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%d/task", procRoot.c_str(), pid);
+            bool cached = Process::fdCacheEnabled && fdBudget.acquire();
+            dir.fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+            if (dir.fd < 0 || !cached)
+            {
+                bool listed = dir.fd >= 0 && listNumericEntries(dir.fd, dir.tids);
+                if (cached)
+                    fdBudget.release();
+                else if (dir.fd >= 0)
+                {
+                    ::close(dir.fd);
+                    procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+                }
+                dir.fd = -1;
+                return listed;
+            }
+        }
+        if (listNumericEntries(dir.fd, dir.tids) && !dir.tids.empty())
+            return true;
+        dir.close(); // an exited process leaves an empty (or unreadable) directory behind
+        return false;
+    }
+
+    // threads skip the owner and memory reads (see Process::inheritFrom())
+    // and the io total, which only the per-pid history uses
+    unsigned slotColumns(const ScanSlot &slot) const
+    {
+        return slot.tgid ? columns & ~(ColumnOwner | ColumnMemory | ColumnIo) : columns;
+    }
+
+    void scanSlot(ScanSlot &slot)
+    {
+        if (slot.existing)
+        {
+            slot.oldStart = slot.existing->getStartTime();
+            slot.alive = slot.existing->refresh(context, slotColumns(slot));
+            if (slot.alive)
+                slot.existing->updateCpuUsage(cpuSampler);
+            return;
+        }
+        slot.created.reset(new Process(slot.pid, context, slotColumns(slot), slot.tgid));
+        slot.alive = slot.created->isLoaded(); // false if it exited between readdir and reading its stat
+        if (slot.alive)
+            slot.created->updateCpuUsage(cpuSampler);
+    }
+
+    // the io_uring path of scanSlots(): the stat and status (or statm) of
+    // every slot in [begin, end) are opened and read through this thread's
+    // ring in a few batched submissions. fds the cache already holds skip the
+    // open, a slot is parsed as soon as its last read completes, and the fds
+    // its process does not adopt are closed through the ring as well.
+    // returns false if this thread has no ring; the caller then scans the
+    // chunk synchronously, as readCached() does for files the ring missed.
+    bool prefetchChunk(vector<ScanSlot> &scan, size_t begin, size_t end)
+    {
+        ScanRing &state = scanRing;
+        if (state.failed)
+            return false;
+        if (!state.ring)
+        {
+            string error;
+            state.ring.reset(new IoUring());
+            if (!state.ring->init(ScanRing::Entries, error))
+            {
+                state.ring.reset();
+                state.failed = true;
+                return false;
+            }
+            state.slots.resize(ScanChunk);
+            state.buffers.resize(ScanChunk * ScanRing::SlotBytes);
+        }
+        // a pool without extra threads hands over everything at once
+        for (size_t first = begin; first < end; first += ScanChunk)
+        {
+            size_t last = min(end, first + ScanChunk);
+            if (state.failed)
+            {
+                for (size_t i = first; i < last; i++)
+                    scanSlot(scan[i]);
+            }
+            else
+            {
+                prefetchBatch(state, scan, first, last);
+            }
+        }
+        return true;
+    }
+
+    // one batch of at most ScanChunk slots through the ring
+    void prefetchBatch(ScanRing &state, vector<ScanSlot> &scan, size_t begin, size_t end)
+    {
+        IoUring &ring = *state.ring;
+        enum Op { OpOpen, OpRead, OpClose };
+        auto userData = [](size_t index, int file, Op op) { return (uint64_t)index << 8 | file << 2 | op; };
+        size_t pending = 0;
+        uint64_t slotNanos = 0;
+        auto start = chrono::steady_clock::now();
+
+        auto queueOpen = [&](size_t index, int file)
+        {
+            // every fd in flight counts against the budget, so with the
+            // cache full the files are left to the synchronous reads
+            if (!fdBudget.acquire())
+                return false;
+            io_uring_sqe *sqe = ring.next();
+            if (!sqe)
+            {
+                fdBudget.release();
+                return false;
+            }
+            ScanRing::Slot &slot = state.slots[index];
+            const ScanSlot &scanned = scan[begin + index];
+            char path[PATH_MAX];
+            if (scanned.tgid)
+                snprintf(path, sizeof(path), "%s/%d/task/%d/%s", procRoot.c_str(), scanned.tgid, scanned.pid, slot.files.file[file]);
+            else
+                snprintf(path, sizeof(path), "%s/%d/%s", procRoot.c_str(), scanned.pid, slot.files.file[file]);
+            slot.path[file].assign(path); // has to stay put until the kernel picks the sqe up
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)slot.path[file].c_str();
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = userData(index, file, OpOpen);
+            procReadCounters.opens.fetch_add(1, memory_order_relaxed);
+            pending++;
+            return true;
+        };
+        auto queueRead = [&](size_t index, int file)
+        {
+            io_uring_sqe *sqe = ring.next();
+            if (!sqe)
+                return false;
+            ScanRing::Slot &slot = state.slots[index];
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = slot.fd[file];
+            sqe->addr = (uint64_t)slot.files.data[file];
+            sqe->len = (file ? ScanRing::SlotBytes - ScanRing::StatBytes : ScanRing::StatBytes) - 1;
+            sqe->off = 0;
+            sqe->user_data = userData(index, file, OpRead);
+            procReadCounters.reads.fetch_add(1, memory_order_relaxed);
+            pending++;
+            return true;
+        };
+        auto queueClose = [&](size_t index, int file)
+        {
+            int fd = state.slots[index].fd[file];
+            io_uring_sqe *sqe = ring.next();
+            procReadCounters.closes.fetch_add(1, memory_order_relaxed);
+            if (!sqe)
+            {
+                close(fd);
+                fdBudget.release();
+                return;
+            }
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fd;
+            sqe->user_data = userData(index, file, OpClose);
+            pending++;
+        };
+        // one file of a slot is done (read or given up on): parse the slot
+        // once all of them are
+        auto fileDone = [&](size_t index)
+        {
+            ScanRing::Slot &slot = state.slots[index];
+            if (--slot.remaining > 0)
+                return;
+            ScanSlot &scanned = scan[begin + index];
+            auto parseStart = chrono::steady_clock::now();
+            prefetchedFiles = &slot.files;
+            scanSlot(scanned);
+            prefetchedFiles = nullptr;
+            slotNanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - parseStart).count();
+            Process *proc = scanned.existing ? scanned.existing : scanned.created.get();
+            for (int file = 0; file < slot.files.count; file++)
+            {
+                if (slot.opened[file] && !(scanned.alive && proc->adoptFd(slot.files.file[file], slot.fd[file])))
+                    queueClose(index, file);
+            }
+        };
+
+        for (size_t index = 0; index < end - begin; index++)
+        {
+            ScanSlot &scanned = scan[begin + index];
+            ScanRing::Slot &slot = state.slots[index];
+            slot.files.count = slot.remaining = Process::mainFiles(slotColumns(scanned), slot.files.file);
+            for (int file = 0; file < slot.files.count; file++)
+            {
+                slot.files.data[file] = &state.buffers[index * ScanRing::SlotBytes + (file ? ScanRing::StatBytes : 0)];
+                slot.files.length[file] = -1;
+                slot.opened[file] = false;
+                slot.fd[file] = scanned.existing ? scanned.existing->cachedFd(slot.files.file[file]) : -1;
+            }
+        }
+        for (size_t index = 0; index < end - begin; index++)
+        {
+            ScanRing::Slot &slot = state.slots[index];
+            for (int file = 0, count = slot.files.count; file < count; file++)
+            {
+                bool queued = slot.fd[file] >= 0 ? queueRead(index, file) : queueOpen(index, file);
+                if (!queued)
+                    fileDone(index);
+            }
+        }
+
+        auto completed = [&](uint64_t data, int result)
+        {
+            pending--;
+            size_t index = data >> 8;
+            int file = (data >> 2) & 3;
+            ScanRing::Slot &slot = state.slots[index];
+            switch ((Op)(data & 3))
+            {
+            case OpOpen:
+                if (result < 0)
+                {
+                    fdBudget.release();
+                    fileDone(index); // gone already, or not readable
+                    break;
+                }
+                slot.fd[file] = result;
+                slot.opened[file] = true;
+                if (!queueRead(index, file))
+                    fileDone(index);
+                break;
+            case OpRead:
+                if (result > 0)
+                {
+                    slot.files.data[file][result] = '\0';
+                    slot.files.length[file] = result;
+                    procReadCounters.bytes.fetch_add(result, memory_order_relaxed);
+                }
+                fileDone(index);
+                break;
+            case OpClose:
+                fdBudget.release();
+                break;
+            }
+        };
+        // procfs files can't be read without blocking, so the kernel hands
+        // these reads to its worker threads and they complete one by one.
+        // waiting for everything in flight keeps it to one io_uring_enter per
+        // round (opens, then reads, then closes); each slot is still parsed as
+        // soon as its completions are reaped.
+        while (pending > 0)
+        {
+            if (!ring.submit(pending))
+            {
+                // the ring is unusable: finish the chunk synchronously and stop
+                // using it. it stays mapped because reads may still be in flight.
+                state.failed = true;
+                for (size_t index = 0; index < end - begin; index++)
+                {
+                    if (state.slots[index].remaining > 0)
+                        scanSlot(scan[begin + index]);
+                }
+                break;
+            }
+            ring.reap(completed);
+        }
+        scanReadNanos += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count() - slotNanos;
+    }
+
+    // read and parse the first count slots, spread over the pool. each chunk
+    // adds its thread's read and total time once, not per file. the thread
+    // walk passes recordPhases = false, it is timed as a whole instead.
+    void scanSlots(vector<ScanSlot> &scan, size_t count, bool recordPhases = true)
+    {
+        atomic<uint64_t> readNanos{0}, scanNanos{0};
+        pool->run(count, ScanChunk, [this, &scan, &readNanos, &scanNanos](size_t begin, size_t end)
+                  {
+                      uint64_t readBefore = scanReadNanos;
+                      auto chunkStart = chrono::steady_clock::now();
+                      if (!ioUringEnabled || !prefetchChunk(scan, begin, end))
+                          for (size_t i = begin; i < end; i++)
+                              scanSlot(scan[i]);
+                      scanNanos.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - chunkStart).count(), memory_order_relaxed);
+                      readNanos.fetch_add(scanReadNanos - readBefore, memory_order_relaxed); });
+        if (!recordPhases)
+            return;
+        refreshStats.add(Phase::Read, readNanos / 1e6);
+        refreshStats.add(Phase::Parse, (scanNanos - readNanos) / 1e6);
+    }
+
+    // the cgroup of every process that has none yet (new or reused pids),
+    // then one sample of every cgroup in use
+    void updateCgroups()
+    {
+        string path;
+        for (auto &[pid, entry] : entries)
+        {
+            Process &proc = *entry.process;
+            if (!proc.hasCgroup())
+                proc.setCgroup(cgroupPaths.intern(readCgroupPath(pid, path) ? path : "?"));
+            if (proc.getCgroupId() >= cgroupUsage.size())
+                cgroupUsage.resize(proc.getCgroupId() + 1);
+            cgroupUsage[proc.getCgroupId()].generation = generation;
+        }
+        double now = chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+        for (uint32_t id = 0; id < cgroupUsage.size(); id++)
+        {
+            CgroupUsage &usage = cgroupUsage[id];
+            if (usage.generation != generation)
+                usage.sampledAt = 0; // empty now, starts over if it comes back
+            else if (cgroupPaths.get(id) != "?")
+                usage.sample(cgroupPaths.get(id), now, context.cpuCount);
+        }
+    }
+
+    // the thread view part of a refresh, after the processes are merged:
+    // list the task directories of the selected processes, then read every
+    // task the same way as the pids, reusing the entries of known tids.
+    // refresh() times all of it as Phase::Threads.
+    void refreshThreads()
+    {
+        taskDirList.clear();
+        auto select = [this](int pid)
+        {
+            TaskDir &dir = taskDirs[pid];
+            dir.seenGeneration = generation;
+            taskDirList.emplace_back(pid, &dir);
+        };
+        if (threadsAll)
+        {
+            for (const auto &[pid, entry] : entries)
+                select(pid);
+        }
+        else
+        {
+            for (int pid : threadPids)
+                if (entries.count(pid))
+                    select(pid);
+        }
+
+        pool->run(taskDirList.size(), ScanChunk, [this](size_t begin, size_t end)
+                  {
+                      for (size_t i = begin; i < end; i++)
+                          if (!listTaskDir(taskDirList[i].first, *taskDirList[i].second))
+                              taskDirList[i].second->seenGeneration = 0; // gone, dropped below
+                  });
+        for (auto it = taskDirs.begin(); it != taskDirs.end();)
+            it = it->second.seenGeneration == generation ? next(it) : taskDirs.erase(it);
+
+        size_t slotCount = 0;
+        for (const auto &[pid, dir] : taskDirList)
+        {
+            if (dir->seenGeneration != generation)
+                continue;
+            for (int tid : dir->tids)
+            {
+                if (slotCount == threadSlots.size())
+                    threadSlots.emplace_back();
+                ScanSlot &slot = threadSlots[slotCount++];
+                auto it = threads.find(tid);
+                slot.pid = tid;
+                slot.tgid = pid;
+                slot.existing = it == threads.end() ? nullptr : it->second.process.get();
+                slot.created.reset();
+                slot.alive = false;
+            }
+        }
+        scanSlots(threadSlots, slotCount, false);
+
+        for (size_t i = 0; i < slotCount; i++)
+        {
+            ScanSlot &slot = threadSlots[i];
+            if (!slot.alive)
+                continue;
+            Process &thread = slot.existing ? *slot.existing : *slot.created;
+            thread.inheritFrom(*entries[slot.tgid].process);
+            if (!slot.existing)
+            {
+                if (generation == threadsSince)
+                    slot.created->setChangeKind(ChangeKind::None); // first listing, nothing to compare with
+                threads[slot.pid] = Entry{std::move(slot.created), generation};
+                continue;
+            }
+            threads[slot.pid].seenGeneration = generation;
+            if (thread.getStartTime() != slot.oldStart)
+                thread.setChangeKind(ChangeKind::Added);
+        }
+        for (auto it = threads.begin(); it != threads.end();)
+            it = it->second.seenGeneration == generation ? next(it) : threads.erase(it);
+    }
+
+public:
+    ProcessTable(size_t threadCount = 1) : pool(new WorkerPool(max<size_t>(1, threadCount))) {}
+    ~ProcessTable()
+    {
+        if (procDirFd >= 0)
+            close(procDirFd);
+    }
+    ProcessTable(const ProcessTable &) = delete;
+
+    void setThreadCount(size_t threadCount) { pool.reset(new WorkerPool(max<size_t>(1, threadCount))); }
+
+    // switch to the event-driven pid list. returns false (and keeps walking
+    // /proc) if the proc connector is not available, with the reason in error.
+    bool enableEvents(string &error)
+    {
+        unique_ptr<ProcEventSource> source(new ProcEventSource());
+        if (!source->start(error))
+            return false;
+        events = std::move(source);
+        fullScanPending = true; // events only tell what changes from now on
+        return true;
+    }
+
+    void disableEvents() { events.reset(); }
+
+    // read the per-pid files through io_uring. returns false (and keeps the
+    // synchronous reads) if the kernel does not offer it, with the reason in error.
+    bool enableIoUring(string &error)
+    {
+        if (!probeIoUring(error))
+            return false;
+        ioUringEnabled = true;
+        return true;
+    }
+
+    void disableIoUring() { ioUringEnabled = false; }
+    bool usesIoUring() const { return ioUringEnabled; }
+
+    // the columns future refreshes read. anything in the mask that the
+    // current snapshot skipped is loaded right away.
+    void setColumns(unsigned mask)
+    {
+        requestedColumns = mask;
+        if (history)
+            mask |= ColumnMemory | ColumnIo; // sampled even when hidden
+        loadColumns(mask);
+        columns = mask | ColumnsFromStat;
+    }
+
+    // keep the last `depth` samples of up to maxProcesses processes.
+    // replaces (and clears) any history kept so far.
+    void enableHistory(size_t depth, size_t maxProcesses)
+    {
+        history.reset(new ProcessHistory(depth, maxProcesses));
+        setColumns(requestedColumns);
+    }
+
+    void disableHistory()
+    {
+        history.reset();
+        setColumns(requestedColumns);
+    }
+
+    const ProcessHistory *getHistory() const { return history.get(); }
+
+    // one-off: load columns for the current snapshot only (e.g. the owner for
+    // 'group owner'), later refreshes go back to the set from setColumns()
+    void loadColumns(unsigned mask)
+    {
+        unsigned missing = mask & ~columns;
+        if (!missing)
+            return;
+        vector<Process *> processes;
+        processes.reserve(entries.size());
+        for (auto &[pid, entry] : entries)
+            processes.push_back(entry.process.get());
+        pool->run(processes.size(), ScanChunk, [&](size_t begin, size_t end)
+                  {
+                      for (size_t i = begin; i < end; i++)
+                          processes[i]->loadColumns(context, missing); });
+        if (missing & ColumnOwner)
+            for (Process *proc : processes)
+                proc->resolveOwner();
+        tree.invalidate();
+    }
+
+    unsigned getColumns() const { return columns; }
+
+    // used when the fd cache is turned off
+    void closeCachedFds()
+    {
+        for (auto &[pid, entry] : entries)
+            entry.process->closeCachedFds();
+        for (auto &[tid, entry] : threads)
+            entry.process->closeCachedFds();
+        for (auto &[pid, dir] : taskDirs)
+            dir.close();
+    }
+    const ProcEventSource *getEvents() const { return events.get(); }
+    size_t getFullScans() const { return fullScans; }
+    size_t getEventScans() const { return eventScans; }
+    size_t getThreadCount() const { return pool->size(); }
+
+    const SnapshotDiff &refresh()
+    {
+        uint64_t opens = procReadCounters.opens, reads = procReadCounters.reads, bytes = procReadCounters.bytes;
+        uint64_t allocations = heapAllocations;
+        refreshStats.refreshes++;
+        auto phaseStart = chrono::steady_clock::now();
+        auto endPhase = [&](Phase phase)
+        {
+            auto now = chrono::steady_clock::now();
+            refreshStats.add(phase, chrono::duration<double, milli>(now - phaseStart).count());
+            phaseStart = now;
+        };
+
+        diff.clear();
+        generation++;
+        context.load(); // memory, uptime and jiffies once for the whole snapshot
+        cpuSampler.sample(context);
+
+        // which pids exist: from the proc connector if it is running and
+        // nothing was lost, with a full /proc walk for the initial sync and
+        // every FullScanEvery refreshes to catch anything it missed
+        pids.clear();
+        bool fullScan = !events || fullScanPending || generation % FullScanEvery == 1;
+        fullScanPending = false;
+        if (events && !events->drain(forkedPids, exitedPids))
+            fullScan = true; // the socket overflowed, events were dropped
+        if (fullScan)
+        {
+            if (!listProcDirectory(pids))
+            {
+                refreshStats.finish(Phase::Enumerate, Phase::Cgroups);
+                return diff;
+            }
+            fullScans++;
+        }
+        else
+        {
+            sort(exitedPids.begin(), exitedPids.end());
+            for (const auto &[pid, entry] : entries)
+                if (!binary_search(exitedPids.begin(), exitedPids.end(), pid))
+                    pids.push_back(pid);
+            // a forked pid is read even if it also exited: it may have been
+            // reused, and reading it replaces (or drops) the stale entry
+            for (int pid : forkedPids)
+                pids.push_back(pid);
+            sort(pids.begin(), pids.end());
+            pids.erase(unique(pids.begin(), pids.end()), pids.end());
+            eventScans++;
+        }
+        endPhase(Phase::Enumerate);
+
+        size_t slotCount = 0;
+        for (int pid : pids)
+        {
+            if (slotCount == slots.size())
+                slots.emplace_back();
+            ScanSlot &slot = slots[slotCount++];
+            auto it = entries.find(pid);
+            slot.pid = pid;
+            slot.tgid = 0;
+            slot.existing = it == entries.end() ? nullptr : it->second.process.get();
+            slot.created.reset();
+            slot.alive = false;
+        }
+
+        scanSlots(slots, slotCount);
+        phaseStart = chrono::steady_clock::now();
+
+        chrono::steady_clock::duration usersTime{0};
+        auto resolve = [&usersTime](Process &proc)
+        {
+            auto start = chrono::steady_clock::now();
+            proc.resolveOwner();
+            usersTime += chrono::steady_clock::now() - start;
+        };
+
+        // merge the slots into the table on this thread
+        for (size_t i = 0; i < slotCount; i++)
+        {
+            ScanSlot &slot = slots[i];
+            if (!slot.alive)
+                continue; // gone, removed below with the other exited pids
+
+            if (!slot.existing)
+            {
+                resolve(*slot.created);
+                if (generation == 1)
+                    slot.created->setChangeKind(ChangeKind::None); // initial sync, nothing to compare with
+                else
+                    diff.added.push_back(slot.pid);
+                tree.insert(*slot.created);
+                entries[slot.pid] = Entry{std::move(slot.created), generation};
+                continue;
+            }
+
+            Process &proc = *slot.existing;
+            entries[slot.pid].seenGeneration = generation;
+            if (proc.getStartTime() != slot.oldStart) // same pid, different process
+            {
+                resolve(proc);
+                proc.setChangeKind(ChangeKind::Added);
+                diff.exited.push_back(slot.pid);
+                diff.added.push_back(slot.pid);
+                tree.remove(slot.pid);
+                tree.insert(proc);
+            }
+            else if (proc.getChangeKind() == ChangeKind::Changed)
+            {
+                resolve(proc);
+                diff.changed.push_back(slot.pid);
+                tree.update(proc);
+            }
+        }
+
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            if (it->second.seenGeneration != generation)
+            {
+                diff.exited.push_back(it->first);
+                tree.remove(it->first);
+                it = entries.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        tree.invalidate();
+        double usersMs = chrono::duration<double, milli>(usersTime).count();
+        refreshStats.add(Phase::Users, usersMs);
+        refreshStats.add(Phase::Merge, chrono::duration<double, milli>(chrono::steady_clock::now() - phaseStart).count() - usersMs);
+        phaseStart = chrono::steady_clock::now();
+
+        if (history)
+        {
+            history->beginTick(diff);
+            for (const auto &[pid, entry] : entries)
+                history->record(*entry.process);
+        }
+        endPhase(Phase::History);
+
+        if (threadsEnabled)
+        {
+            refreshThreads();
+            endPhase(Phase::Threads);
+        }
+
+        if (cgroupsEnabled)
+        {
+            updateCgroups();
+            endPhase(Phase::Cgroups);
+        }
+
+        refreshStats.opens = procReadCounters.opens - opens;
+        refreshStats.reads = procReadCounters.reads - reads;
+        refreshStats.bytes = procReadCounters.bytes - bytes;
+        refreshStats.allocations = heapAllocations - allocations;
+        refreshStats.finish(Phase::Enumerate, Phase::Cgroups);
+        return diff;
+    }
+
+    template <typename Callback>
+    void forEach(Callback callback) const
+    {
+        for (const auto &[pid, entry] : entries)
+            callback(*entry.process);
+    }
+
+    template <typename Callback>
+    void forEachThread(Callback callback) const
+    {
+        for (const auto &[tid, entry] : threads)
+            callback(*entry.process);
+    }
+
+    // list the threads of these processes (of every process if all) from
+    // the next refresh on
+    void showThreads(bool all, vector<int> selected)
+    {
+        sort(selected.begin(), selected.end());
+        threadsEnabled = true;
+        threadsAll = all;
+        threadPids = std::move(selected);
+        threadsSince = generation + 1;
+    }
+
+    void hideThreads()
+    {
+        threadsEnabled = false;
+        threadsAll = false;
+        threadPids.clear();
+        taskDirs.clear();
+        threads.clear();
+    }
+
+    // start tracking cgroups, from this snapshot on. their CPU% and IO rates
+    // need a second sample, so they show from the next refresh.
+    void enableCgroups()
+    {
+        if (cgroupsEnabled)
+            return;
+        cgroupsEnabled = true;
+        updateCgroups();
+    }
+
+    const string &cgroupPath(uint32_t id) const { return cgroupPaths.get(id); }
+    const CgroupUsage &getCgroupUsage(uint32_t id) const { return cgroupUsage[id]; }
+
+    bool showsThreads() const { return threadsEnabled; }
+    bool showsAllThreads() const { return threadsAll; }
+    const vector<int> &getThreadPids() const { return threadPids; }
+    size_t threadRowCount() const { return threads.size(); }
+
+    // true if the process is listed per thread instead of as one row
+    bool isExpanded(int pid) const
+    {
+        return threadsEnabled && taskDirs.count(pid) > 0;
+    }
+
+    Process *find(int pid) const
+    {
+        auto it = entries.find(pid);
+        return it == entries.end() ? nullptr : it->second.process.get();
+    }
+
+    size_t size() const { return entries.size(); }
+    int getCpuCount() const { return context.cpuCount; }
+    const SystemContext &getContext() const { return context; }
+    const SnapshotDiff &getLastDiff() const { return diff; }
+
+    // subtree totals are computed on first use after a refresh
+    ProcessTree &getTree()
+    {
+        tree.computeTotals();
+        return tree;
+    }
+};
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+// sends a signal to a batch of processes without ever hitting a recycled pid.
+// every target is pinned with a pidfd and checked against the start time it
+// was listed with before anything is sent; then all of them are signalled and
+// their exits are waited for together with poll() on the pidfds. whatever is
+// still running after the timeout gets SIGKILL.
+class SignalBatch
+{
+public:
+    enum class Outcome
+    {
+        Pending,
+        Exited,   // exited after the first signal
+        Killed,   // only exited after SIGKILL
+        Survived, // still there after SIGKILL too (e.g. stuck in uninterruptible sleep)
+        Gone,     // had already exited, nothing sent
+        Reused,   // the pid belongs to another process by now, nothing sent
+        Denied,   // no permission to signal it
+        Skipped,  // ourselves or init
+        Signalled, // sent without waiting for the exit
+        Failed,
+    };
+
+    struct Target
+    {
+        int pid;
+        unsigned long long startTime; // as listed in the snapshot it was picked from
+        string name;
+        int pidfd = -1;
+        Outcome outcome = Outcome::Pending;
+        int error = 0;      // errno for Failed
+        double seconds = 0; // from the first signal until it exited
+    };
+
+    static const char *describe(Outcome outcome)
+    {
+        static const char *const names[] = {"pending", "exited", "killed", "survived SIGKILL", "already gone",
+                                            "pid reused, skipped", "permission denied", "skipped", "signalled", "failed"};
+        return names[(int)outcome];
+    }
+
+    // start time of whatever has the pid right now, 0 if nothing does
+    static unsigned long long currentStartTime(int pid)
+    {
+        char statBuffer[4096];
+        StatFields fields;
+        ssize_t statLength = readProcFile(pid, "stat", statBuffer, sizeof(statBuffer));
+        return statLength > 0 && parseStatLine(statBuffer, statLength, fields) ? fields.starttime : 0;
+    }
+
+private:
+    vector<Target> targets;
+    chrono::steady_clock::time_point started;
+
+    void pin(Target &target)
+    {
+        if (target.pid <= 1 || target.pid == getpid())
+        {
+            target.outcome = Outcome::Skipped;
+            return;
+        }
+        target.pidfd = syscall(SYS_pidfd_open, target.pid, 0);
+        if (target.pidfd < 0)
+        {
+            target.error = errno;
+            target.outcome = errno == ESRCH ? Outcome::Gone : Outcome::Failed;
+            return;
+        }
+        // the pidfd refers to whatever had the pid when it was opened, so if
+        // the start time still matches it is the process that was listed
+        unsigned long long startTime = currentStartTime(target.pid);
+        if (startTime != target.startTime)
+        {
+            target.outcome = startTime == 0 ? Outcome::Gone : Outcome::Reused;
+            closeTarget(target);
+        }
+    }
+
+    void send(int signal, Outcome exitedAs)
+    {
+        for (Target &target : targets)
+        {
+            if (target.outcome != Outcome::Pending)
+                continue;
+            if (syscall(SYS_pidfd_send_signal, target.pidfd, signal, nullptr, 0) == 0)
+                continue;
+            target.error = errno;
+            if (errno == ESRCH) // exited in the meantime
+                finish(target, exitedAs);
+            else
+            {
+                target.outcome = errno == EPERM ? Outcome::Denied : Outcome::Failed;
+                closeTarget(target);
+            }
+        }
+    }
+
+    // poll the pidfds of the pending targets until they have all exited or
+    // the deadline passes. a pidfd becomes readable when its process exits.
+    void wait(chrono::steady_clock::time_point deadline, Outcome exitedAs)
+    {
+        vector<pollfd> fds;
+        vector<Target *> waiting;
+        while (true)
+        {
+            fds.clear();
+            waiting.clear();
+            for (Target &target : targets)
+            {
+                if (target.outcome != Outcome::Pending)
+                    continue;
+                fds.push_back(pollfd{target.pidfd, POLLIN, 0});
+                waiting.push_back(&target);
+            }
+            auto now = chrono::steady_clock::now();
+            if (fds.empty() || now >= deadline)
+                return;
+            int timeoutMs = (int)chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1;
+            int ready = poll(fds.data(), fds.size(), timeoutMs);
+            if (ready < 0 && errno != EINTR)
+                return;
+            for (size_t i = 0; ready > 0 && i < fds.size(); i++)
+                if (fds[i].revents)
+                    finish(*waiting[i], exitedAs);
+        }
+    }
+
+    void finish(Target &target, Outcome outcome)
+    {
+        target.outcome = outcome;
+        target.seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+        closeTarget(target);
+    }
+
+    static void closeTarget(Target &target)
+    {
+        if (target.pidfd >= 0)
+            close(target.pidfd);
+        target.pidfd = -1;
+    }
+
+public:
+    SignalBatch() = default;
+    SignalBatch(const SignalBatch &) = delete; // owns the pidfds
+    ~SignalBatch()
+    {
+        for (Target &target : targets)
+            closeTarget(target);
+    }
+
+    void add(int pid, unsigned long long startTime, const string &name)
+    {
+        Target target;
+        target.pid = pid;
+        target.startTime = startTime;
+        target.name = name;
+        targets.push_back(std::move(target));
+    }
+
+    size_t size() const { return targets.size(); }
+    const vector<Target> &getTargets() const { return targets; }
+
+    // pin them all before the first signal goes out. false if the kernel has
+    // no pidfds (before 5.3).
+    bool pinAll(string &error)
+    {
+        for (Target &target : targets)
+        {
+            pin(target);
+            if (target.outcome == Outcome::Failed && target.error == ENOSYS)
+            {
+                error = "pidfd_open is not supported by this kernel";
+                for (Target &other : targets)
+                    closeTarget(other);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // signal every target, then SIGKILL the ones that are still running after
+    // timeoutSeconds. returns false if the kernel has no pidfds, in which case
+    // nothing was sent.
+    bool run(int signal, double timeoutSeconds, string &error)
+    {
+        if (!pinAll(error))
+            return false;
+
+        started = chrono::steady_clock::now();
+        auto timeout = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(timeoutSeconds));
+        send(signal, Outcome::Exited);
+        wait(started + timeout, Outcome::Exited);
+        if (signal != SIGKILL)
+        {
+            send(SIGKILL, Outcome::Killed);
+            wait(chrono::steady_clock::now() + chrono::seconds(2), Outcome::Killed);
+        }
+        for (Target &target : targets)
+        {
+            if (target.outcome != Outcome::Pending)
+                continue;
+            target.outcome = Outcome::Survived;
+            closeTarget(target);
+        }
+        return true;
+    }
+
+    // the same pinning, but only send the signal and don't wait for anything
+    bool signalOnly(int signal, string &error)
+    {
+        if (!pinAll(error))
+            return false;
+        started = chrono::steady_clock::now();
+        send(signal, Outcome::Gone);
+        for (Target &target : targets)
+        {
+            if (target.outcome != Outcome::Pending)
+                continue;
+            target.outcome = Outcome::Signalled;
+            closeTarget(target);
+        }
+        return true;
+    }
+};
+
+// columnar copy of the process table, rebuilt after each refresh. every field
+// lives in its own contiguous array indexed by row, and names/owners are
+// interned ids, so sort/filter/group scan plain arrays instead of chasing
+// Process pointers and comparing strings.
+class ProcessColumns
+{
+private:
+    StringInterner names;
+    vector<uint32_t> nameRanks; // nameId -> position in alphabetical order
+
+public:
+    vector<int> pid;
+    vector<int> ppid;
+    vector<int> priority;
+    vector<double> cpu;
+    vector<double> memory;
+    vector<char> state;
+    vector<uint32_t> nameId;
+    vector<uint32_t> ownerId; // id in userCache
+    vector<uid_t> uid;
+    vector<ChangeKind> change;
+    vector<double> extra[ExtraMetricCount]; // optional columns, 0 where not loaded
+    const ProcessHistory *history = nullptr; // the table's, for sparklines
+    uint32_t nameEpoch = 0;  // bumped when the name ids start over, for caches keyed by name id
+    bool threadRows = false; // some rows are threads: pid holds the tid, ppid the process
+
+    // with the thread view on, an expanded process is replaced by one row per
+    // thread. the main thread (tid == pid) keeps the process's parent.
+    // processesOnly keeps one row per process either way.
+    void build(const ProcessTable &table, bool processesOnly = false)
+    {
+        bool withThreads = table.showsThreads() && !processesOnly;
+        clear(table.size() + (withThreads ? table.threadRowCount() : 0));
+        history = table.getHistory();
+        threadRows = withThreads;
+        auto appendProcess = [this](const Process &proc, int parent)
+        {
+            append(proc.getPID(), parent, proc.getPriority(), proc.getCPUUsage(), proc.getMemoryUsage(),
+                   proc.getStatus()[0], proc.getName(), proc.getOwnerId(), proc.getUid(), proc.getChangeKind(),
+                   proc.getExtras());
+        };
+        table.forEach([&](const Process &proc)
+                      {
+                          if (!withThreads || !table.isExpanded(proc.getPID()))
+                              appendProcess(proc, proc.getParentPID()); });
+        if (withThreads)
+            table.forEachThread([&](const Process &thread)
+                                { appendProcess(thread, thread.getPID() == thread.getThreadGroup() ? thread.getParentPID() : thread.getThreadGroup()); });
+        finish();
+    }
+
+    // building from other sources (a replayed capture): clear(), append() per
+    // process, then finish()
+    void clear(size_t count)
+    {
+        if (names.size() > 4 * count + 1024) // names of exited processes pile up, start over now and then
+        {
+            names = StringInterner();
+            nameEpoch++;
+        }
+
+        for (auto *column : {&pid, &ppid, &priority})
+            column->clear();
+        cpu.clear();
+        memory.clear();
+        state.clear();
+        nameId.clear();
+        ownerId.clear();
+        uid.clear();
+        change.clear();
+        for (vector<double> &column : extra)
+            column.clear();
+        history = nullptr;
+        threadRows = false;
+        for (auto *column : {&pid, &ppid, &priority})
+            column->reserve(count);
+    }
+
+    void append(int rowPid, int rowPpid, int rowPriority, double rowCpu, double rowMemory, char rowState,
+                const string &rowName, uint32_t rowOwnerId, uid_t rowUid, ChangeKind rowChange,
+                const double *rowExtras = nullptr)
+    {
+        pid.push_back(rowPid);
+        ppid.push_back(rowPpid);
+        priority.push_back(rowPriority);
+        cpu.push_back(rowCpu);
+        memory.push_back(rowMemory);
+        state.push_back(rowState);
+        nameId.push_back(names.intern(rowName));
+        ownerId.push_back(rowOwnerId);
+        uid.push_back(rowUid);
+        change.push_back(rowChange);
+        for (int metric = 0; metric < ExtraMetricCount; metric++)
+            extra[metric].push_back(rowExtras ? rowExtras[metric] : 0);
+    }
+
+    void finish()
+    {
+        // rank the distinct names once so sorting by name compares integers
+        vector<uint32_t> byName(names.size());
+        for (uint32_t id = 0; id < byName.size(); id++)
+            byName[id] = id;
+        sort(byName.begin(), byName.end(), [this](uint32_t a, uint32_t b)
+             { return names.get(a) < names.get(b); });
+        nameRanks.assign(byName.size(), 0);
+        for (uint32_t rank = 0; rank < byName.size(); rank++)
+            nameRanks[byName[rank]] = rank;
+    }
+
+    size_t size() const { return pid.size(); }
+    const string &name(uint32_t row) const { return names.get(nameId[row]); }
+    const string &owner(uint32_t row) const { return userCache.name(ownerId[row]); }
+    uint32_t nameRank(uint32_t row) const { return nameRanks[nameId[row]]; }
+    size_t nameCount() const { return names.size(); }
+    const string &nameById(uint32_t id) const { return names.get(id); }
+};
+
+// a selection/permutation of rows of a ProcessColumns: sorting reorders the
+// row indexes and filtering keeps a subset, the columns are never touched
+struct ProcessView
+{
+    const ProcessColumns *columns = nullptr;
+    vector<uint32_t> rows;
+    unsigned visibleColumns = ColumnsDefault; // ColumnMask of what gets printed
+
+    // every row, in pid order
+    static ProcessView all(const ProcessColumns &columns)
+    {
+        ProcessView view;
+        view.columns = &columns;
+        view.rows.resize(columns.size());
+        for (uint32_t row = 0; row < view.rows.size(); row++)
+            view.rows[row] = row;
+        sort(view.rows.begin(), view.rows.end(), [&](uint32_t a, uint32_t b)
+             { return columns.pid[a] < columns.pid[b]; });
+        return view;
+    }
+
+    // same columns, no rows yet
+    ProcessView emptyCopy() const
+    {
+        ProcessView view;
+        view.columns = columns;
+        view.visibleColumns = visibleColumns;
+        return view;
+    }
+
+    size_t size() const { return rows.size(); }
+    bool empty() const { return rows.empty(); }
+};
+
+enum class SortKey
+{
+    Memory,
+    Priority,
+    Pid,
+    Ppid,
+    Name,
+    Cpu,
+    // the optional columns, in ExtraMetric order
+    IoRead,
+    IoWrite,
+    Pss,
+    Swap,
+    Voluntary,
+    Involuntary,
+    SchedWait
+};
+
+// orders the view's rows by one column, ties broken by pid. with a limit
+// only the first `limit` rows are ordered (partial_sort keeps a bounded heap)
+// and the rest are dropped from the view.
+void sortRows(ProcessView &view, SortKey key, bool descending, size_t limit = SIZE_MAX)
+{
+    const ProcessColumns &c = *view.columns;
+    size_t keep = min(limit, view.rows.size());
+    auto byColumn = [&](const auto &column)
+    {
+        auto compare = [&](uint32_t a, uint32_t b)
+        {
+            if (column[a] != column[b])
+                return descending ? column[a] > column[b] : column[a] < column[b];
+            return c.pid[a] < c.pid[b];
+        };
+        if (keep < view.rows.size())
+            partial_sort(view.rows.begin(), view.rows.begin() + keep, view.rows.end(), compare);
+        else
+            sort(view.rows.begin(), view.rows.end(), compare);
+    };
+
+    switch (key)
+    {
+    case SortKey::Memory:
+        byColumn(c.memory);
+        break;
+    case SortKey::Priority:
+        byColumn(c.priority);
+        break;
+    case SortKey::Pid:
+        byColumn(c.pid);
+        break;
+    case SortKey::Ppid:
+        byColumn(c.ppid);
+        break;
+    case SortKey::Cpu:
+        byColumn(c.cpu);
+        break;
+    case SortKey::Name:
+    {
+        vector<uint32_t> ranks(c.size());
+        for (uint32_t row = 0; row < ranks.size(); row++)
+            ranks[row] = c.nameRank(row);
+        byColumn(ranks);
+        break;
+    }
+    default:
+        byColumn(c.extra[(int)key - (int)SortKey::IoRead]);
+        break;
+    }
+    view.rows.resize(keep);
+}
+
+struct SortOption
+{
+    const char *name;  // what the user types
+    SortKey key;
+    const char *label; // for messages
+    unsigned column;   // ColumnMask the key reads
+};
+
+const SortOption sortOptions[] = {
+    {"memory", SortKey::Memory, "memory usage", ColumnMemory},
+    {"priority", SortKey::Priority, "priority", ColumnPriority},
+    {"pid", SortKey::Pid, "PID", ColumnPid},
+    {"ppid", SortKey::Ppid, "PPID", ColumnPpid},
+    {"name", SortKey::Name, "name", ColumnName},
+    {"cpu", SortKey::Cpu, "CPU usage", ColumnCpu},
+    {"ioread", SortKey::IoRead, "disk reads", ColumnIoRead},
+    {"iowrite", SortKey::IoWrite, "disk writes", ColumnIoWrite},
+    {"pss", SortKey::Pss, "PSS", ColumnPss},
+    {"swap", SortKey::Swap, "swap usage", ColumnSwap},
+    {"vcsw", SortKey::Voluntary, "voluntary context switches", ColumnVoluntary},
+    {"ivcsw", SortKey::Involuntary, "involuntary context switches", ColumnInvoluntary},
+    {"wait", SortKey::SchedWait, "run queue wait", ColumnSchedWait},
+};
+
+const SortOption *findSortOption(const string &name)
+{
+    for (const SortOption &option : sortOptions)
+        if (name == option.name)
+            return &option;
+    return nullptr;
+}
+
+// one filter condition on a row. prepare() runs once per view (e.g. to match
+// every distinct name once), test() once per row.
+struct RowFilter
+{
+    string description;
+    unsigned columns = 0; // ColumnMask the test reads
+    function<void(const ProcessColumns &)> prepare;
+    function<bool(const ProcessColumns &, uint32_t)> test;
+};
+
+// builds a filter from its kind (memory/priority/name/owner/cpu/new/changed)
+// and value; returns false and sets error if either is invalid
+bool makeFilter(const string &kind, const string &value, RowFilter &filter, string &error)
+{
+    try
+    {
+        if (kind == "memory" || kind == "cpu" || kind == "priority")
+        {
+            double threshold = stod(value);
+            filter.description = kind + " > " + value;
+            filter.columns = kind == "memory" ? ColumnMemory : kind == "cpu" ? ColumnCpu : ColumnPriority;
+            if (kind == "memory")
+                filter.test = [threshold](const ProcessColumns &c, uint32_t row)
+                { return c.memory[row] > threshold; };
+            else if (kind == "cpu")
+                filter.test = [threshold](const ProcessColumns &c, uint32_t row)
+                { return c.cpu[row] > threshold; };
+            else
+                filter.test = [threshold](const ProcessColumns &c, uint32_t row)
+                { return c.priority[row] > threshold; };
+            return true;
+        }
+    }
+    catch (...)
+    {
+        error = "Invalid threshold '" + value + "'.";
+        return false;
+    }
+
+    if (kind == "name")
+    {
+        // match each distinct name once per view, then pick rows by name id
+        auto matches = make_shared<vector<bool>>();
+        filter.description = "name ~ " + value;
+        filter.columns = ColumnName;
+        filter.prepare = [matches, value](const ProcessColumns &c)
+        {
+            matches->assign(c.nameCount(), false);
+            for (uint32_t id = 0; id < matches->size(); id++)
+                (*matches)[id] = c.nameById(id).find(value) != string::npos;
+        };
+        filter.test = [matches](const ProcessColumns &c, uint32_t row)
+        { return (*matches)[c.nameId[row]]; };
+        return true;
+    }
+    if (kind == "owner")
+    {
+        filter.description = "owner ~ " + value;
+        filter.columns = ColumnOwner;
+        filter.test = [value](const ProcessColumns &c, uint32_t row)
+        { return c.owner(row).find(value) != string::npos; };
+        return true;
+    }
+    if (kind == "new" || kind == "changed")
+    {
+        // processes that appeared / changed in the last refresh
+        ChangeKind wanted = kind == "new" ? ChangeKind::Added : ChangeKind::Changed;
+        filter.description = kind;
+        filter.test = [wanted](const ProcessColumns &c, uint32_t row)
+        { return c.change[row] == wanted; };
+        return true;
+    }
+    const SortOption *extraOption = findSortOption(kind); // the optional columns filter on "> threshold" too
+    if (extraOption && extraOption->key >= SortKey::IoRead)
+    {
+        double threshold;
+        if (from_chars(value.data(), value.data() + value.size(), threshold).ec != errc() || value.empty())
+        {
+            error = "Invalid threshold '" + value + "'.";
+            return false;
+        }
+        int metric = (int)extraOption->key - (int)SortKey::IoRead;
+        if (metric <= MetricSwap)
+            threshold *= 1024; // given in the units shown: KB/s and MB
+        filter.description = kind + " > " + value;
+        filter.columns = extraOption->column;
+        filter.test = [metric, threshold](const ProcessColumns &c, uint32_t row)
+        { return c.extra[metric][row] > threshold; };
+        return true;
+    }
+    error = "Invalid filter option. Please try again.";
+    return false;
+}
+
+// what the current view shows: the active filters (all must match), the
+// sort order and an optional top-K limit. re-applied after every refresh.
+struct ViewSettings
+{
+    vector<RowFilter> filters;
+    const SortOption *sortBy = nullptr; // null: pid order
+    bool descending = false;
+    size_t limit = SIZE_MAX;
+    unsigned visibleColumns = ColumnsDefault; // set with the 'columns' command
+    unsigned watchColumns = 0;                // what the watchdog rules look at
+
+    // what the next refresh has to read: the printed columns plus whatever the
+    // sort key, the filters and the watchdog look at
+    unsigned neededColumns() const
+    {
+        unsigned mask = visibleColumns | watchColumns;
+        if (sortBy)
+            mask |= sortBy->column;
+        for (const RowFilter &filter : filters)
+            mask |= filter.columns;
+        return mask;
+    }
+
+    string describeFilters() const
+    {
+        string text;
+        for (const RowFilter &filter : filters)
+            text += (text.empty() ? "" : " AND ") + filter.description;
+        return text.empty() ? "none" : text;
+    }
+};
+
+// streams the rows through the filters into a selection, then sorts it (or
+// only its top `limit` rows). no Process or column data is copied.
+ProcessView buildView(const ProcessColumns &columns, const ViewSettings &settings)
+{
+    PhaseTimer timer(Phase::SortFilter);
+    if (settings.filters.empty() && !settings.sortBy)
+    {
+        ProcessView view = ProcessView::all(columns);
+        view.visibleColumns = settings.visibleColumns;
+        return view;
+    }
+
+    for (const RowFilter &filter : settings.filters)
+        if (filter.prepare)
+            filter.prepare(columns);
+
+    ProcessView view;
+    view.columns = &columns;
+    view.visibleColumns = settings.visibleColumns;
+    for (uint32_t row = 0; row < columns.size(); row++)
+    {
+        bool keep = true;
+        for (const RowFilter &filter : settings.filters)
+        {
+            if (!filter.test(columns, row))
+            {
+                keep = false;
+                break;
+            }
+        }
+        if (keep)
+            view.rows.push_back(row);
+    }
+
+    if (settings.sortBy)
+        sortRows(view, settings.sortBy->key, settings.descending, settings.limit);
+    else
+        sortRows(view, SortKey::Pid, false);
+    return view;
+}
+
+// ANSI color codes
+#define COLOR_RESET "\033[0m"
+#define COLOR_HEADER "\033[1;36m"    // Bold cyan
+#define COLOR_LABEL "\033[1;33m"     // Bold yellow
+#define COLOR_VALUE "\033[0;37m"     // Light gray
+#define COLOR_HIGHLIGHT "\033[1;32m" // Bold green
+
+// the printable columns in display order
+struct ColumnInfo
+{
+    const char *name; // for the 'columns' command
+    ColumnMask mask;
+    const char *header;
+    int width;
+};
+
+const ColumnInfo columnInfos[] = {
+    {"pid", ColumnPid, "PID", 8},
+    {"ppid", ColumnPpid, "PPID", 8},
+    {"name", ColumnName, "Name", 25},
+    {"owner", ColumnOwner, "Owner", 12},
+    {"memory", ColumnMemory, "Memory(%)", 12},
+    {"cpu", ColumnCpu, "CPU(%)", 10},
+    {"status", ColumnState, "Status", 8},
+    {"priority", ColumnPriority, "Priority", 10},
+    {"history", ColumnHistory, "CPU history", 18},
+    {"ioread", ColumnIoRead, "Read(KB/s)", 12},
+    {"iowrite", ColumnIoWrite, "Write(KB/s)", 12},
+    {"pss", ColumnPss, "PSS(MB)", 10},
+    {"swap", ColumnSwap, "Swap(MB)", 10},
+    {"vcsw", ColumnVoluntary, "Vcsw/s", 9},
+    {"ivcsw", ColumnInvoluntary, "Ivcsw/s", 9},
+    {"wait", ColumnSchedWait, "Wait(ms/s)", 11},
+};
+
+// parses "pid,name,cpu", "default" or "all" into a ColumnMask, 0 if a name is unknown
+unsigned parseColumnList(const string &list)
+{
+    if (list == "default")
+        return ColumnsDefault;
+    if (list == "all")
+        return ColumnsAll;
+    unsigned mask = 0;
+    stringstream names(list);
+    string name;
+    while (getline(names, name, ','))
+    {
+        const ColumnInfo *found = nullptr;
+        for (const ColumnInfo &info : columnInfos)
+            if (name == info.name)
+                found = &info;
+        if (!found)
+            return 0;
+        mask |= found->mask;
+    }
+    return mask;
+}
+
+string describeColumns(unsigned mask)
+{
+    string text;
+    for (const ColumnInfo &info : columnInfos)
+        if (mask & info.mask)
+            text += (text.empty() ? "" : ",") + string(info.name);
+    return text;
+}
+
+// formats the table into lines (without newlines). diff is optional: when
+// given, new processes are marked with '+', changed ones with '*' and the
+// footer shows how many pids were added/exited/changed. at most maxRows
+// process rows are formatted, the rest is summarised in one line. only the
+// view's visible columns are printed.
+void formatProcesses(const ProcessView &view, const SnapshotDiff *diff, vector<string> &lines, size_t maxRows = SIZE_MAX)
+{
+    char line[512];
+    unsigned visible = view.visibleColumns;
+    const ProcessColumns &c = *view.columns;
+
+    // Header section
+    string header = COLOR_HEADER "  ";
+    int tableWidth = 2;
+    for (const ColumnInfo &info : columnInfos)
+    {
+        if (!(visible & info.mask))
+            continue;
+        snprintf(line, sizeof(line), "%-*s", info.width, c.threadRows && info.mask == ColumnPid ? "PID/TID" : info.header);
+        header += line;
+        tableWidth += info.width;
+    }
+    lines.push_back(header + COLOR_RESET);
+    string separator = COLOR_LABEL + string(tableWidth, '-') + COLOR_RESET;
+    lines.push_back(separator);
+
+    size_t shown = min(maxRows, view.size());
+    string text;
+    for (size_t i = 0; i < shown; i++)
+    {
+        uint32_t row = view.rows[i];
+
+        // You can highlight high memory or CPU processes
+        bool isHighCPU = c.cpu[row] > 10.0;
+        bool isHighMem = c.memory[row] > 5.0;
+
+        char marker = ' ';
+        if (diff && c.change[row] == ChangeKind::Added)
+            marker = '+';
+        else if (diff && c.change[row] == ChangeKind::Changed)
+            marker = '*';
+
+        text.assign(1, marker);
+        text += ' ';
+        for (const ColumnInfo &info : columnInfos)
+        {
+            if (!(visible & info.mask))
+                continue;
+            switch (info.mask)
+            {
+            case ColumnPid:
+                snprintf(line, sizeof(line), "%-*d", info.width, c.pid[row]);
+                break;
+            case ColumnPpid:
+                snprintf(line, sizeof(line), "%-*d", info.width, c.ppid[row]);
+                break;
+            case ColumnName:
+                snprintf(line, sizeof(line), "%-*.*s", info.width, info.width - 1, c.name(row).c_str());
+                break;
+            case ColumnOwner:
+                snprintf(line, sizeof(line), "%-*.*s", info.width, info.width - 1, c.owner(row).c_str());
+                break;
+            case ColumnMemory:
+                snprintf(line, sizeof(line), "%s%-*.1f" COLOR_RESET, isHighMem ? COLOR_HIGHLIGHT : "", info.width, c.memory[row]);
+                break;
+            case ColumnCpu:
+                snprintf(line, sizeof(line), "%s%-*.1f" COLOR_RESET, isHighCPU ? COLOR_HIGHLIGHT : "", info.width, c.cpu[row]);
+                break;
+            case ColumnState:
+                snprintf(line, sizeof(line), "%-*c", info.width, c.state[row]);
+                break;
+            case ColumnHistory:
+                // block characters are 3 bytes each, so no printf padding
+                snprintf(line, sizeof(line), "%s  ", c.history ? c.history->sparkline(c.pid[row], ProcessHistory::Metric::Cpu, info.width - 2).c_str() : string(info.width - 2, ' ').c_str());
+                break;
+            case ColumnPriority:
+                snprintf(line, sizeof(line), "%-*d", info.width, c.priority[row]);
+                break;
+            default:
+            {
+                // optional columns. io bytes/s and PSS/swap kB are shown as KB/s and MB
+                int metric = __builtin_ctz(info.mask) - __builtin_ctz(ColumnIoRead);
+                double value = c.extra[metric][row];
+                if (metric <= MetricSwap)
+                    value /= 1024;
+                snprintf(line, sizeof(line), "%-*.1f", info.width, value);
+                break;
+            }
+            }
+            text += line;
+        }
+        lines.push_back(text);
+    }
+    if (shown < view.size())
+        lines.push_back("  ... " + to_string(view.size() - shown) + " more");
+
+    lines.push_back(separator);
+    string footer = COLOR_HEADER + string(c.threadRows ? "Total Processes/Threads: " : "Total Processes: ") + COLOR_VALUE + to_string(view.size()) + COLOR_RESET;
+    if (diff)
+    {
+        footer += COLOR_HEADER "  Added: " COLOR_VALUE + to_string(diff->added.size()) +
+                  COLOR_HEADER "  Exited: " COLOR_VALUE + to_string(diff->exited.size()) +
+                  COLOR_HEADER "  Changed: " COLOR_VALUE + to_string(diff->changed.size()) + COLOR_RESET;
+    }
+    lines.push_back(footer);
+}
+
+void displayProcesses(const ProcessView &view, const SnapshotDiff *diff = nullptr)
+{
+    {
+        PhaseTimer timer(Phase::Render);
+        vector<string> lines;
+        formatProcesses(view, diff, lines);
+
+        string output; // one buffer and one flush instead of an endl per row
+        for (const string &line : lines)
+        {
+            output += line;
+            output += '\n';
+        }
+        output += '\n';
+        cout << output << flush;
+    }
+    if (refreshStats.statusLine)
+        cout << COLOR_VALUE << refreshStats.summary() << COLOR_RESET << endl;
+}
+
+// prints the process tree below rootPid (every root if rootPid is 0), each
+// line with the process's own CPU% and the totals of its whole subtree
+void displayTree(ProcessTable &table, int rootPid, size_t maxDepth = SIZE_MAX)
+{
+    ProcessTree &tree = table.getTree();
+    char line[512];
+    string output;
+    snprintf(line, sizeof(line), COLOR_HEADER "%-8s%-40s%-10s%-12s%-14s%-10s%-8s" COLOR_RESET "\n",
+             "PID", "Name", "CPU(%)", "Tree CPU(%)", "Tree RSS(MB)", "Threads", "Procs");
+    output += line;
+    output += COLOR_LABEL + string(102, '-') + COLOR_RESET "\n";
+
+    vector<pair<int, size_t>> stack; // pid, depth; pre-order so parents print first
+    vector<int> children;
+    vector<int> roots = rootPid ? vector<int>{rootPid} : tree.roots();
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it)
+        stack.push_back({*it, 0});
+    while (!stack.empty())
+    {
+        auto [pid, depth] = stack.back();
+        stack.pop_back();
+        const Process *proc = table.find(pid);
+        if (!proc)
+            continue;
+
+        const ProcessTree::Totals &totals = tree.totals(pid);
+        string label = depth == 0 ? proc->getName() : string(2 * (depth - 1), ' ') + "`- " + proc->getName();
+        snprintf(line, sizeof(line), "%-8d%-40.39s%-10.1f%s%-12.1f" COLOR_RESET "%-14.1f%-10ld%-8zu\n",
+                 pid, label.c_str(), proc->getCPUUsage(), totals.cpu > 10.0 ? COLOR_HIGHLIGHT : "",
+                 totals.cpu, totals.rssKB / 1024.0, totals.threads, totals.processes);
+        output += line;
+
+        if (depth + 1 > maxDepth)
+            continue;
+        children = tree.children(pid);
+        sort(children.begin(), children.end(), greater<int>()); // popped in ascending pid order
+        for (int child : children)
+            if (child != pid)
+                stack.push_back({child, depth + 1});
+    }
+    cout << output << endl;
+}
+
+// draws full-screen frames for auto mode. each frame is compared line by line
+// with the previous one and only the changed lines are redrawn, clipped to the
+// terminal height, and the whole update goes out in a single write().
+class FrameRenderer
+{
+private:
+    vector<string> previous;
+    unsigned short lastRows = 0;
+    unsigned short lastColumns = 0;
+    string buffer;
+    string input; // shown on the cursor row, see drawInput()
+
+    void writeBuffer()
+    {
+        cout << flush; // anything already in cout goes before the frame
+        const char *data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0)
+        {
+            ssize_t written = write(STDOUT_FILENO, data, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            data += written;
+            remaining -= written;
+        }
+    }
+
+public:
+    // terminal size from TIOCGWINSZ, 24x80 if stdout is not a terminal
+    static void terminalSize(unsigned short &rows, unsigned short &columns)
+    {
+        struct winsize size;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0)
+        {
+            rows = size.ws_row;
+            columns = size.ws_col;
+            return;
+        }
+        rows = 24;
+        columns = 80;
+    }
+
+    static unsigned short terminalRows()
+    {
+        unsigned short rows, columns;
+        terminalSize(rows, columns);
+        return rows;
+    }
+
+    void draw(const vector<string> &frame)
+    {
+        unsigned short rows, columns;
+        terminalSize(rows, columns);
+        size_t visible = min<size_t>(frame.size(), rows - 1); // keep the last row for the cursor
+
+        buffer.clear();
+        bool fullRedraw = rows != lastRows || columns != lastColumns || previous.empty();
+        if (fullRedraw)
+        {
+            buffer += "\033[?7l"; // no line wrapping, long lines are cut at the right edge
+            buffer += "\033[2J";
+            previous.clear();
+        }
+
+        char move[32];
+        for (size_t i = 0; i < visible; i++)
+        {
+            if (i < previous.size() && previous[i] == frame[i])
+                continue;
+            snprintf(move, sizeof(move), "\033[%zu;1H", i + 1);
+            buffer += move;
+            buffer += frame[i];
+            buffer += "\033[K"; // clear whatever the old line had past the end of the new one
+        }
+        for (size_t i = visible; i < previous.size(); i++) // the frame got shorter
+        {
+            snprintf(move, sizeof(move), "\033[%zu;1H\033[K", i + 1);
+            buffer += move;
+        }
+        snprintf(move, sizeof(move), "\033[%zu;1H", visible + 1);
+        buffer += move;
+        buffer += input;
+        buffer += "\033[K";
+
+        previous.assign(frame.begin(), frame.begin() + visible);
+        lastRows = rows;
+        lastColumns = columns;
+        writeBuffer();
+    }
+
+    // the line being typed under the frame, redrawn right away and kept
+    // there by every later draw()
+    void drawInput(const string &line)
+    {
+        input = line;
+        buffer = "\r" + input + "\033[K";
+        writeBuffer();
+    }
+
+    bool hasFrame() const { return !previous.empty(); }
+
+    // forget the last frame and turn line wrapping back on
+    void reset()
+    {
+        previous.clear();
+        input.clear();
+        lastRows = lastColumns = 0;
+        cout << "\033[?7h" << flush;
+    }
+};
+
+// ---- interactive event loop ----
+
+// everything the interactive loop waits for, on one epoll: stdin, a timerfd
+// for sampling ticks and one for frames, a signalfd for Ctrl+C and window
+// resizes, and an eventfd the BackgroundSampler pokes after each refresh.
+// in key mode (while auto-refreshing) the terminal is not line buffered and
+// the typed line is kept here, so keys are seen as they are pressed.
+class EventLoop
+{
+public:
+    enum class Event
+    {
+        Line,       // a full line from stdin
+        Input,      // key mode: the line being typed changed, see getInput()
+        SampleTick, // time for the next sample
+        RenderTick, // time for the next frame
+        Sampled,    // the background sampler finished a refresh
+        Interrupt,  // Ctrl+C
+        Resize,     // the terminal changed size
+        Eof         // end of input, reported once
+    };
+
+private:
+    int epollFd = -1;
+    int sampleTimer = -1;
+    int renderTimer = -1;
+    int signalFd = -1;
+    int wakeFd = -1;
+    bool stdinPolled = false; // epoll refuses regular files, those are read directly
+    bool stdinOpen = true;
+    bool eofReported = false;
+    string pending; // read from stdin but not handled yet
+    string input;   // key mode: the line typed so far
+    bool keyMode = false;
+    termios savedTermios;
+
+    static void armTimer(int fd, double seconds)
+    {
+        itimerspec spec = {};
+        if (seconds > 0)
+        {
+            long long nanos = llround(seconds * 1e9);
+            spec.it_interval.tv_sec = nanos / 1000000000;
+            spec.it_interval.tv_nsec = nanos % 1000000000;
+            spec.it_value = spec.it_interval;
+        }
+        timerfd_settime(fd, 0, &spec, nullptr);
+    }
+
+    static void drain(int fd)
+    {
+        uint64_t count;
+        while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+            ;
+    }
+
+    bool watch(int fd)
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    // appends what stdin has to pending, marks the end of input
+    void readStdin()
+    {
+        char buffer[4096];
+        ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (length < 0 && (errno == EINTR || errno == EAGAIN))
+            return;
+        if (length <= 0)
+        {
+            stdinOpen = false;
+            if (stdinPolled)
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, STDIN_FILENO, nullptr);
+            return;
+        }
+        pending.append(buffer, length);
+    }
+
+    bool takeLine(string &line)
+    {
+        size_t newline = pending.find('\n');
+        if (newline == string::npos)
+        {
+            if (stdinOpen || pending.empty())
+                return false;
+            newline = pending.size(); // the last line had no newline
+        }
+        line.assign(pending, 0, newline);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        pending.erase(0, newline + 1);
+        return true;
+    }
+
+    // key mode: applies the pending keys to input. returns Line on Enter,
+    // Input if the line was edited, Eof if there was nothing to do
+    Event takeKeys(string &line)
+    {
+        bool edited = false;
+        size_t i = 0;
+        for (; i < pending.size(); i++)
+        {
+            unsigned char key = pending[i];
+            if (key == '\n' || key == '\r')
+            {
+                line = input;
+                input.clear();
+                pending.erase(0, i + 1);
+                return Event::Line;
+            }
+            if (key == 0x7f || key == '\b') // backspace
+            {
+                if (!input.empty())
+                    input.pop_back();
+            }
+            else if (key == 0x15) // Ctrl+U
+            {
+                input.clear();
+            }
+            else if (key == 0x04 && input.empty()) // Ctrl+D on an empty line is Enter
+            {
+                line.clear();
+                pending.erase(0, i + 1);
+                return Event::Line;
+            }
+            else if (key == 0x1b) // arrows and other escape sequences are skipped
+            {
+                if (i + 1 < pending.size() && (pending[i + 1] == '[' || pending[i + 1] == 'O'))
+                {
+                    i += 2;
+                    while (i < pending.size() && (pending[i] < 0x40 || pending[i] > 0x7e))
+                        i++;
+                }
+            }
+            else if (key >= ' ')
+            {
+                input += key;
+            }
+            edited = true;
+        }
+        pending.erase(0, i);
+        return edited ? Event::Input : Event::Eof;
+    }
+
+public:
+    EventLoop() = default;
+    EventLoop(const EventLoop &) = delete;
+
+    ~EventLoop()
+    {
+        setKeyMode(false);
+        for (int fd : {epollFd, sampleTimer, renderTimer, signalFd, wakeFd})
+            if (fd >= 0)
+                close(fd);
+    }
+
+    // blocks SIGINT and SIGWINCH for the signalfd, so it must run before any
+    // thread is started: threads inherit the mask, and one that did not block
+    // them would take the signal instead
+    bool init(string &error)
+    {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGWINCH);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        sampleTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        renderTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || sampleTimer < 0 || renderTimer < 0 || signalFd < 0 || wakeFd < 0 ||
+            !watch(sampleTimer) || !watch(renderTimer) || !watch(signalFd) || !watch(wakeFd))
+        {
+            error = strerror(errno);
+            return false;
+        }
+        stdinPolled = watch(STDIN_FILENO);
+        if (!stdinPolled && errno != EPERM)
+        {
+            error = string("stdin: ") + strerror(errno);
+            return false;
+        }
+        return true;
+    }
+
+    // seconds between SampleTicks and between RenderTicks, 0 stops them
+    void setTimers(double sampleSeconds, double renderSeconds)
+    {
+        armTimer(sampleTimer, sampleSeconds);
+        armTimer(renderTimer, renderSeconds);
+    }
+
+    // key mode takes the terminal out of line buffering and echo (Ctrl+C
+    // still raises SIGINT). nothing changes if stdin is not a terminal.
+    void setKeyMode(bool on)
+    {
+        if (on == keyMode || !isatty(STDIN_FILENO))
+            return;
+        if (on)
+        {
+            if (tcgetattr(STDIN_FILENO, &savedTermios) != 0)
+                return;
+            termios raw = savedTermios;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        }
+        else
+        {
+            tcsetattr(STDIN_FILENO, TCSANOW, &savedTermios);
+            input.clear();
+        }
+        keyMode = on;
+    }
+
+    const string &getInput() const { return input; }
+    bool inputClosed() const { return !stdinOpen && pending.empty(); }
+
+    // called from the sampler thread
+    void wake()
+    {
+        uint64_t one = 1;
+        while (write(wakeFd, &one, sizeof(one)) < 0 && errno == EINTR)
+            ;
+    }
+
+    // blocks until something happens. when several sources are ready, signals
+    // go first, then the sampler, stdin and the timers; the others stay ready
+    // for the next call.
+    Event wait(string &line)
+    {
+        while (true)
+        {
+            if (keyMode)
+            {
+                Event typed = takeKeys(line);
+                if (typed != Event::Eof)
+                    return typed;
+            }
+            else if (takeLine(line))
+            {
+                return Event::Line;
+            }
+            if (!stdinOpen && !eofReported)
+            {
+                eofReported = true;
+                return Event::Eof;
+            }
+            if (stdinOpen && !stdinPolled)
+            {
+                readStdin(); // a file, never blocks
+                continue;
+            }
+
+            epoll_event events[8];
+            int count = epoll_wait(epollFd, events, 8, -1);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return Event::Eof;
+            }
+            bool ready[5] = {}; // signals, sampler, stdin, sample timer, render timer
+            for (int i = 0; i < count; i++)
+            {
+                int fd = events[i].data.fd;
+                ready[fd == signalFd ? 0 : fd == wakeFd ? 1 : fd == STDIN_FILENO ? 2 : fd == sampleTimer ? 3 : 4] = true;
+            }
+            if (ready[0])
+            {
+                signalfd_siginfo info;
+                if (read(signalFd, &info, sizeof(info)) == sizeof(info))
+                    return info.ssi_signo == SIGINT ? Event::Interrupt : Event::Resize;
+                continue;
+            }
+            if (ready[1])
+            {
+                drain(wakeFd);
+                return Event::Sampled;
+            }
+            if (ready[2])
+            {
+                readStdin();
+                continue;
+            }
+            if (ready[3])
+            {
+                drain(sampleTimer);
+                return Event::SampleTick;
+            }
+            drain(renderTimer);
+            return Event::RenderTick;
+        }
+    }
+
+    // a whole line for a command's follow-up question, with the terminal
+    // back in line mode. false at the end of input or on Ctrl+C.
+    bool readLine(string &line)
+    {
+        bool wasKeyMode = keyMode;
+        setKeyMode(false);
+        bool read = false;
+        while (!(read = takeLine(line)) && stdinOpen)
+        {
+            if (!stdinPolled)
+            {
+                readStdin();
+                continue;
+            }
+            pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {signalFd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0)
+                continue;
+            if (fds[1].revents)
+            {
+                signalfd_siginfo info;
+                if (::read(signalFd, &info, sizeof(info)) == sizeof(info) && info.ssi_signo == SIGINT)
+                    break;
+            }
+            if (fds[0].revents)
+                readStdin();
+        }
+        setKeyMode(wasKeyMode);
+        return read;
+    }
+
+    // reads one value from a line, like cin >> value did before
+    template <typename T>
+    bool prompt(T &value)
+    {
+        string line;
+        if (!readLine(line))
+            return false;
+        stringstream(line) >> value;
+        return true;
+    }
+};
+
+// refreshes the process table on its own thread, one refresh per request().
+// the main thread keeps reading input while /proc is walked and gets a
+// Sampled event afterwards. a request made during a refresh becomes the next
+// refresh, so slow scans never queue up. the table is only touched with
+// tableMutex held.
+class BackgroundSampler
+{
+private:
+    ProcessTable &table;
+    mutex &tableMutex;
+    EventLoop &loop;
+    mutex requestMutex;
+    condition_variable requestReady;
+    bool requested = false;
+    bool stopping = false;
+    thread worker;
+
+    void run()
+    {
+        unique_lock<mutex> lock(requestMutex);
+        while (true)
+        {
+            requestReady.wait(lock, [this]
+                              { return requested || stopping; });
+            if (stopping)
+                return;
+            requested = false;
+            lock.unlock();
+            {
+                lock_guard<mutex> tableLock(tableMutex);
+                table.refresh();
+            }
+            loop.wake();
+            lock.lock();
+        }
+    }
+
+public:
+    BackgroundSampler(ProcessTable &processTable, mutex &processTableMutex, EventLoop &eventLoop)
+        : table(processTable), tableMutex(processTableMutex), loop(eventLoop), worker(&BackgroundSampler::run, this) {}
+
+    // must not be called with tableMutex held, the refresh in progress needs it
+    ~BackgroundSampler()
+    {
+        {
+            lock_guard<mutex> lock(requestMutex);
+            stopping = true;
+        }
+        requestReady.notify_one();
+        worker.join();
+    }
+
+    void request()
+    {
+        {
+            lock_guard<mutex> lock(requestMutex);
+            requested = true;
+        }
+        requestReady.notify_one();
+    }
+};
+
+// ---- batch mode ----
+
+enum class BatchFormat
+{
+    JsonLines,
+    Csv,
+    Binary
+};
+
+// fixed-width record of the binary batch format, little-endian as written by
+// the host. the stream starts with a BinaryHeader, then one record per
+// process per tick; records of one tick share the same timestamp.
+#pragma pack(push, 1)
+struct BinaryHeader
+{
+    char magic[4];       // "LPMB"
+    uint16_t version;    // 1
+    uint16_t recordSize; // sizeof(BinaryRecord)
+};
+
+struct BinaryRecord
+{
+    uint64_t timestampMs; // unix time of the tick in milliseconds
+    int32_t pid;
+    int32_t ppid;
+    uint32_t uid;   // 0xffffffff if unknown
+    int32_t priority;
+    float cpu;      // % over the last interval, per core
+    float memory;   // % of total memory
+    char state;
+    char reserved[3];
+    char name[16];  // comm, null-padded, not always null-terminated
+};
+#pragma pack(pop)
+
+static_assert(sizeof(BinaryRecord) == 52, "binary batch records are fixed-width");
+
+struct BatchOptions
+{
+    BatchFormat format = BatchFormat::JsonLines;
+    double interval = 1.0; // seconds, may be fractional
+    long count = 0;        // ticks to emit, 0 = until interrupted
+    string outputPath;     // empty = stdout
+};
+
+string jsonEscape(const string &value)
+{
+    string escaped;
+    for (unsigned char ch : value)
+    {
+        if (ch == '"' || ch == '\\')
+        {
+            escaped += '\\';
+            escaped += ch;
+        }
+        else if (ch < 0x20)
+        {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", ch);
+            escaped += code;
+        }
+        else
+        {
+            escaped += ch;
+        }
+    }
+    return escaped;
+}
+
+string csvEscape(const string &value)
+{
+    if (value.find_first_of(",\"\n") == string::npos)
+        return value;
+    string escaped = "\"";
+    for (char ch : value)
+    {
+        if (ch == '"')
+            escaped += '"';
+        escaped += ch;
+    }
+    return escaped + "\"";
+}
+
+// appends one tick's records to out, in the order of the view
+void formatBatchTick(const ProcessView &view, BatchFormat format, uint64_t timestampMs, string &out)
+{
+    const ProcessColumns &c = *view.columns;
+    char line[512];
+    for (uint32_t row : view.rows)
+    {
+        if (format == BatchFormat::Binary)
+        {
+            BinaryRecord record;
+            memset(&record, 0, sizeof(record));
+            record.timestampMs = timestampMs;
+            record.pid = c.pid[row];
+            record.ppid = c.ppid[row];
+            record.uid = c.uid[row];
+            record.priority = c.priority[row];
+            record.cpu = c.cpu[row];
+            record.memory = c.memory[row];
+            record.state = c.state[row];
+            const string &name = c.name(row);
+            memcpy(record.name, name.data(), min(name.size(), sizeof(record.name))); // fixed width, zeroed above
+            out.append((const char *)&record, sizeof(record));
+        }
+        else if (format == BatchFormat::Csv)
+        {
+            snprintf(line, sizeof(line), "%llu,%d,%d,%s,%s,%.2f,%.2f,%c,%d\n",
+                     (unsigned long long)timestampMs, c.pid[row], c.ppid[row],
+                     csvEscape(c.name(row)).c_str(), csvEscape(c.owner(row)).c_str(),
+                     c.memory[row], c.cpu[row], c.state[row], c.priority[row]);
+            out += line;
+        }
+        else
+        {
+            snprintf(line, sizeof(line),
+                     "{\"ts\":%llu,\"pid\":%d,\"ppid\":%d,\"name\":\"%s\",\"owner\":\"%s\",\"memory\":%.2f,\"cpu\":%.2f,\"state\":\"%c\",\"priority\":%d}\n",
+                     (unsigned long long)timestampMs, c.pid[row], c.ppid[row],
+                     jsonEscape(c.name(row)).c_str(), jsonEscape(c.owner(row)).c_str(),
+                     c.memory[row], c.cpu[row], c.state[row], c.priority[row]);
+            out += line;
+        }
+    }
+}
+
+// non-interactive collector loop: one record per process per tick, no colours
+// or prompts. the table is primed once before the first tick so every emitted
+// CPU% covers a full interval.
+int runBatch(const BatchOptions &options, ProcessTable &processTable)
+{
+    int fd = STDOUT_FILENO;
+    if (!options.outputPath.empty())
+    {
+        fd = open(options.outputPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            perror("Error opening batch output");
+            return 1;
+        }
+    }
+
+    string out;
+    if (options.format == BatchFormat::Binary)
+    {
+        BinaryHeader header = {{'L', 'P', 'M', 'B'}, 1, sizeof(BinaryRecord)};
+        out.append((const char *)&header, sizeof(header));
+    }
+    else if (options.format == BatchFormat::Csv)
+    {
+        out += "ts,pid,ppid,name,owner,memory,cpu,state,priority\n";
+    }
+
+    ProcessColumns columns;
+    processTable.refresh();
+    auto nextTick = chrono::steady_clock::now();
+    bool ok = true;
+    for (long tick = 0; running && ok && (options.count == 0 || tick < options.count); tick++)
+    {
+        nextTick += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.interval));
+        this_thread::sleep_until(nextTick);
+        if (!running)
+            break;
+
+        processTable.refresh();
+        columns.build(processTable);
+        uint64_t timestampMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        formatBatchTick(ProcessView::all(columns), options.format, timestampMs, out);
+
+        // one tick at a time so a reader on the other end of a pipe sees it right away
+        const char *data = out.data();
+        size_t remaining = out.size();
+        while (remaining > 0)
+        {
+            ssize_t written = write(fd, data, remaining);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+            {
+                ok = false; // reader went away or the disk is full
+                break;
+            }
+            data += written;
+            remaining -= written;
+        }
+        out.clear();
+    }
+
+    if (fd != STDOUT_FILENO)
+        close(fd);
+    return ok ? 0 : 1;
+}
+
+// ---- record / replay ----
+
+// capture files: a CaptureFileHeader, then one snapshot after another, each a
+// CaptureSnapshotHeader followed by its records, the pids that exited since
+// the previous snapshot and a string table (null-terminated names and owners
+// the records point into). "<file>.idx" holds one CaptureIndexEntry per
+// snapshot, written after the snapshot itself, so the index never points at a
+// half-written snapshot and seeking is a binary search over it.
+#pragma pack(push, 1)
+struct CaptureFileHeader
+{
+    char magic[4];       // "LPMC"
+    uint16_t version;    // 1
+    uint16_t recordSize; // sizeof(CaptureRecord)
+    uint32_t cpuCount;   // of the recording machine, for 'cpumode total'
+};
+
+struct CaptureSnapshotHeader
+{
+    uint64_t timestampMs; // unix time, never decreasing within a file
+    uint32_t recordCount;
+    uint32_t exitedCount;
+    uint32_t stringBytes;
+    uint32_t reserved;
+};
+
+struct CaptureRecord
+{
+    int32_t pid;
+    int32_t ppid;
+    uint32_t uid; // 0xffffffff if unknown
+    int32_t priority;
+    float cpu;    // % over the last interval, per core
+    float memory; // % of total memory
+    uint32_t nameOffset;  // into the snapshot's string table
+    uint32_t ownerOffset;
+    char state;
+    uint8_t change; // ChangeKind
+    char reserved[2];
+};
+
+struct CaptureIndexEntry
+{
+    uint64_t timestampMs;
+    uint64_t offset; // of the CaptureSnapshotHeader in the capture file
+};
+#pragma pack(pop)
+
+static_assert(sizeof(CaptureRecord) == 36, "capture records are fixed-width");
+
+uint64_t captureSnapshotBytes(const CaptureSnapshotHeader &header)
+{
+    return sizeof(header) + (uint64_t)header.recordCount * sizeof(CaptureRecord) +
+           (uint64_t)header.exitedCount * sizeof(int32_t) + header.stringBytes;
+}
+
+// appends snapshots to a capture file. an existing file is continued: a
+// snapshot whose index entry is missing is re-indexed, and a half-written one
+// at the end (the recorder was killed mid-write) is cut off.
+class CaptureWriter
+{
+private:
+    int dataFd = -1;
+    int indexFd = -1;
+    uint64_t dataSize = 0;
+    uint64_t lastTimestampMs = 0;
+    string buffer;
+    string strings;
+    unordered_map<string, uint32_t> stringOffsets;
+
+    uint32_t addString(const string &value)
+    {
+        auto it = stringOffsets.find(value);
+        if (it != stringOffsets.end())
+            return it->second;
+        uint32_t offset = strings.size();
+        strings.append(value.c_str(), value.size() + 1);
+        stringOffsets.emplace(value, offset);
+        return offset;
+    }
+
+    static bool writeAll(int fd, const char *data, size_t size, off_t offset = -1)
+    {
+        while (size > 0)
+        {
+            ssize_t written = offset < 0 ? write(fd, data, size) : pwrite(fd, data, size, offset);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            data += written;
+            size -= written;
+            if (offset >= 0)
+                offset += written;
+        }
+        return true;
+    }
+
+    // walks the snapshots after the last indexed one, indexing the complete
+    // ones, and truncates whatever is left
+    bool recover(uint64_t fileSize, string &error)
+    {
+        struct stat indexStat;
+        fstat(indexFd, &indexStat);
+        size_t entries = indexStat.st_size / sizeof(CaptureIndexEntry);
+        uint64_t offset = sizeof(CaptureFileHeader);
+        if (entries > 0)
+        {
+            CaptureIndexEntry last;
+            if (pread(indexFd, &last, sizeof(last), (entries - 1) * sizeof(last)) == sizeof(last) &&
+                last.offset >= offset && last.offset < fileSize)
+            {
+                offset = last.offset; // re-checked below like any other snapshot
+                entries--;
+            }
+            else
+            {
+                entries = 0; // an index we cannot trust, rebuild it
+            }
+        }
+        if (ftruncate(indexFd, entries * sizeof(CaptureIndexEntry)) != 0)
+        {
+            error = string("cannot truncate the index: ") + strerror(errno);
+            return false;
+        }
+
+        CaptureSnapshotHeader header;
+        while (offset + sizeof(header) <= fileSize && pread(dataFd, &header, sizeof(header), offset) == sizeof(header))
+        {
+            uint64_t end = offset + captureSnapshotBytes(header);
+            if (end > fileSize)
+                break;
+            CaptureIndexEntry entry = {header.timestampMs, offset};
+            if (!writeAll(indexFd, (const char *)&entry, sizeof(entry)))
+            {
+                error = string("cannot write the index: ") + strerror(errno);
+                return false;
+            }
+            lastTimestampMs = header.timestampMs;
+            offset = end;
+        }
+        if (offset < fileSize && ftruncate(dataFd, offset) != 0)
+        {
+            error = string("cannot cut off a partial snapshot: ") + strerror(errno);
+            return false;
+        }
+        dataSize = offset;
+        return true;
+    }
+
+public:
+    ~CaptureWriter()
+    {
+        if (dataFd >= 0)
+            close(dataFd);
+        if (indexFd >= 0)
+            close(indexFd);
+    }
+
+    bool open(const string &path, uint32_t cpuCount, string &error)
+    {
+        dataFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        indexFd = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (dataFd < 0 || indexFd < 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+
+        struct stat dataStat;
+        fstat(dataFd, &dataStat);
+        if (dataStat.st_size == 0)
+        {
+            CaptureFileHeader header = {{'L', 'P', 'M', 'C'}, 1, sizeof(CaptureRecord), cpuCount};
+            dataSize = sizeof(header);
+            if (ftruncate(indexFd, 0) != 0 || !writeAll(dataFd, (const char *)&header, sizeof(header), 0))
+            {
+                error = strerror(errno);
+                return false;
+            }
+            return true;
+        }
+
+        CaptureFileHeader header;
+        if (pread(dataFd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, "LPMC", 4) != 0 ||
+            header.version != 1 || header.recordSize != sizeof(CaptureRecord))
+        {
+            error = "not a capture file, or one from another version";
+            return false;
+        }
+        return recover(dataStat.st_size, error);
+    }
+
+    // one snapshot: every row of the columns plus the pids that exited
+    bool append(const ProcessColumns &c, const SnapshotDiff &diff, uint64_t timestampMs)
+    {
+        timestampMs = max(timestampMs, lastTimestampMs); // the index stays sorted if the clock steps back
+        strings.clear();
+        stringOffsets.clear();
+
+        CaptureSnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        header.timestampMs = timestampMs;
+        header.recordCount = c.size();
+        header.exitedCount = diff.exited.size();
+        buffer.assign(sizeof(header), '\0'); // filled in once the string table size is known
+
+        CaptureRecord record;
+        for (uint32_t row = 0; row < c.size(); row++)
+        {
+            memset(&record, 0, sizeof(record));
+            record.pid = c.pid[row];
+            record.ppid = c.ppid[row];
+            record.uid = c.uid[row];
+            record.priority = c.priority[row];
+            record.cpu = c.cpu[row];
+            record.memory = c.memory[row];
+            record.nameOffset = addString(c.name(row));
+            record.ownerOffset = addString(c.owner(row));
+            record.state = c.state[row];
+            record.change = (uint8_t)c.change[row];
+            buffer.append((const char *)&record, sizeof(record));
+        }
+        for (int pid : diff.exited)
+        {
+            int32_t exitedPid = pid;
+            buffer.append((const char *)&exitedPid, sizeof(exitedPid));
+        }
+        header.stringBytes = strings.size();
+        memcpy(&buffer[0], &header, sizeof(header));
+        buffer += strings;
+
+        CaptureIndexEntry entry = {timestampMs, dataSize};
+        if (!writeAll(dataFd, buffer.data(), buffer.size(), dataSize) ||
+            !writeAll(indexFd, (const char *)&entry, sizeof(entry)))
+            return false;
+        dataSize += buffer.size();
+        lastTimestampMs = timestampMs;
+        return true;
+    }
+};
+
+// read side: the capture and its index are mmapped, a snapshot is only
+// decoded when it is loaded into a ProcessColumns. without a usable index
+// file the snapshots are walked once to rebuild it in memory.
+class CaptureReader
+{
+private:
+    const char *data = nullptr;
+    size_t dataSize = 0;
+    void *indexMap = nullptr;
+    size_t indexMapSize = 0;
+    const CaptureIndexEntry *index = nullptr;
+    size_t count = 0;
+    vector<CaptureIndexEntry> rebuiltIndex;
+    uint32_t cpuCount = 1;
+
+    static void *mapFile(const string &path, size_t &size)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return nullptr;
+        struct stat fileStat;
+        void *mapped = nullptr;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+        {
+            size = fileStat.st_size;
+            mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+                mapped = nullptr;
+        }
+        close(fd); // the mapping keeps the file
+        return mapped;
+    }
+
+    bool snapshotFits(uint64_t offset) const
+    {
+        CaptureSnapshotHeader header;
+        if (offset < sizeof(CaptureFileHeader) || offset > dataSize || dataSize - offset < sizeof(header))
+            return false;
+        memcpy(&header, data + offset, sizeof(header));
+        return offset + captureSnapshotBytes(header) <= dataSize;
+    }
+
+    // how many leading entries of the mapped index can be used. each has to
+    // point at the snapshot right after the previous one, with the same
+    // timestamp, not older than the one before. entries past the end of the
+    // mapped file are cut off (the recorder may still be writing); anything
+    // else means the index doesn't belong to the file and none is used.
+    size_t checkIndex() const
+    {
+        uint64_t expected = sizeof(CaptureFileHeader);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (index[i].offset != expected)
+                return 0;
+            if (!snapshotFits(expected))
+                return i;
+            CaptureSnapshotHeader header;
+            memcpy(&header, data + expected, sizeof(header));
+            if (header.timestampMs != index[i].timestampMs || (i > 0 && header.timestampMs < index[i - 1].timestampMs))
+                return 0;
+            expected += captureSnapshotBytes(header);
+        }
+        return count;
+    }
+
+    void rebuildIndex()
+    {
+        rebuiltIndex.clear();
+        uint64_t offset = sizeof(CaptureFileHeader);
+        while (snapshotFits(offset))
+        {
+            CaptureSnapshotHeader header;
+            memcpy(&header, data + offset, sizeof(header));
+            rebuiltIndex.push_back({header.timestampMs, offset});
+            offset += captureSnapshotBytes(header);
+        }
+        index = rebuiltIndex.data();
+        count = rebuiltIndex.size();
+    }
+
+public:
+    ~CaptureReader()
+    {
+        if (data)
+            munmap((void *)data, dataSize);
+        if (indexMap)
+            munmap(indexMap, indexMapSize);
+    }
+
+    bool open(const string &path, string &error)
+    {
+        data = (const char *)mapFile(path, dataSize);
+        CaptureFileHeader header;
+        if (!data || dataSize < sizeof(header))
+        {
+            error = "cannot read " + path;
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        if (memcmp(header.magic, "LPMC", 4) != 0 || header.version != 1 || header.recordSize != sizeof(CaptureRecord))
+        {
+            error = path + " is not a capture file, or one from another version";
+            return false;
+        }
+        cpuCount = max(1u, header.cpuCount);
+
+        indexMap = mapFile(path + ".idx", indexMapSize);
+        if (indexMap)
+        {
+            index = (const CaptureIndexEntry *)indexMap;
+            count = indexMapSize / sizeof(CaptureIndexEntry);
+            count = checkIndex();
+        }
+        if (count == 0 && dataSize > sizeof(header))
+            rebuildIndex();
+        if (count == 0)
+        {
+            error = path + " holds no snapshots";
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const { return count; }
+    uint64_t timestamp(size_t snapshot) const { return index[snapshot].timestampMs; }
+
+    // the first snapshot at or after timestampMs (the last one if there is
+    // none), by binary search over the index
+    size_t seek(uint64_t timestampMs) const
+    {
+        const CaptureIndexEntry *found = lower_bound(index, index + count, timestampMs, [](const CaptureIndexEntry &entry, uint64_t value)
+                                                     { return entry.timestampMs < value; });
+        return found == index + count ? count - 1 : found - index;
+    }
+
+    // decodes one snapshot into the same columns and diff a live refresh produces
+    void load(size_t snapshot, ProcessColumns &columns, SnapshotDiff &diff) const
+    {
+        const char *base = data + index[snapshot].offset;
+        CaptureSnapshotHeader header;
+        memcpy(&header, base, sizeof(header));
+        const char *records = base + sizeof(header);
+        const char *exited = records + (size_t)header.recordCount * sizeof(CaptureRecord);
+        const char *strings = exited + (size_t)header.exitedCount * sizeof(int32_t);
+        auto stringAt = [&](uint32_t offset)
+        {
+            if (offset >= header.stringBytes)
+                return string();
+            return string(strings + offset, strnlen(strings + offset, header.stringBytes - offset));
+        };
+
+        columns.clear(header.recordCount);
+        diff.clear();
+        CaptureRecord record;
+        for (uint32_t i = 0; i < header.recordCount; i++)
+        {
+            memcpy(&record, records + i * sizeof(CaptureRecord), sizeof(record));
+            ChangeKind change = record.change <= (uint8_t)ChangeKind::Changed ? (ChangeKind)record.change : ChangeKind::None;
+            double cpu = Process::normalizedCpu ? record.cpu / cpuCount : record.cpu;
+            columns.append(record.pid, record.ppid, record.priority, cpu, record.memory, record.state,
+                           stringAt(record.nameOffset), userCache.intern(stringAt(record.ownerOffset)), record.uid, change);
+            if (change == ChangeKind::Added)
+                diff.added.push_back(record.pid);
+            else if (change == ChangeKind::Changed)
+                diff.changed.push_back(record.pid);
+        }
+        for (uint32_t i = 0; i < header.exitedCount; i++)
+        {
+            int32_t pid;
+            memcpy(&pid, exited + i * sizeof(pid), sizeof(pid));
+            diff.exited.push_back(pid);
+        }
+        columns.finish();
+    }
+
+    uint32_t getCpuCount() const { return cpuCount; }
+};
+
+// formats a capture timestamp as local time
+string formatTimestamp(uint64_t timestampMs)
+{
+    time_t seconds = timestampMs / 1000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    char text[64];
+    size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+    snprintf(text + length, sizeof(text) - length, ".%03u", (unsigned)(timestampMs % 1000));
+    return text;
+}
+
+// watchdog rules, one per line of a config file:
+//   [name:] condition [and condition]... [for 30s] [clear 10s] then action[,action] [limit 5 per 60s]
+// e.g. "runaway: cpu > 90 and owner == app for 30s then term,log". conditions
+// compare a column (cpu, memory, priority, pid, ppid, the optional ones, name,
+// owner or state) with a value; actions are log, term, kill and stop. a line
+// "log <file>" sends the log lines to a file instead of the terminal.
+//
+// the rules are compiled once into conditions on ProcessColumns fields. on
+// every snapshot each rule only walks the rows of its most selective
+// condition, taken from indexes built once per snapshot (rows sorted by the
+// value of each compared field, and rows bucketed by owner, state and name),
+// so hundreds of rules cost about as much as a few scans of the columns.
+class Watchdog
+{
+public:
+    enum class Field
+    {
+        Cpu,
+        Memory,
+        Priority,
+        Pid,
+        Ppid,
+        Extra, // an ExtraMetric
+        Name,
+        Owner,
+        State
+    };
+
+    enum class Op
+    {
+        Greater,
+        GreaterEqual,
+        Less,
+        LessEqual,
+        Equal,
+        NotEqual,
+        Contains // names only
+    };
+
+    struct Condition
+    {
+        Field field;
+        Op op;
+        int metric = 0;    // for Extra
+        double number = 0; // numeric fields, in the units the rows hold
+        uid_t uid = 0;
+        char state = 0;
+        string text; // for Name
+
+        // name conditions: whether each interned name matches (== or ~, != is
+        // the negation), extended as new names show up
+        vector<char> nameMatches;
+        vector<uint32_t> matchingNames;
+        uint32_t nameEpoch = 0;
+    };
+
+    struct Pending // hysteresis state of one process for one rule
+    {
+        double since;    // when the conditions started to hold
+        double lastTrue; // the last snapshot they held in
+        unsigned long tick;
+        bool fired;
+    };
+
+    struct Rule
+    {
+        string name;
+        string text; // the line it was compiled from
+        vector<Condition> conditions;
+        double forSeconds = 0;
+        double clearSeconds = 0;
+        bool log = false;
+        int signal = 0;
+        size_t limit = 10; // at most this many firings per limitSeconds
+        double limitSeconds = 60;
+
+        unordered_map<int, Pending> pending; // by pid
+        deque<double> firedAt;
+        size_t fired = 0;
+        size_t suppressed = 0;
+    };
+
+private:
+    // numeric fields by index key: the five plain ones, then one per ExtraMetric
+    static const int NumericKeys = 5 + ExtraMetricCount;
+
+    // rows with value >= aboveFrom sorted by descending value (for > and >=),
+    // and rows with value <= belowUpTo ascending (for < and <=)
+    struct NumericIndex
+    {
+        bool wantAbove = false, wantBelow = false;
+        double aboveFrom = 0, belowUpTo = 0;
+        vector<pair<double, uint32_t>> above, below;
+    };
+
+    struct Firing
+    {
+        size_t rule;
+        uint32_t row;
+        double heldSeconds;
+    };
+
+    vector<Rule> rules;
+    unsigned columns = 0;
+    string logPath;
+    ofstream logFile;
+    unsigned long tick = 0;
+
+    NumericIndex numeric[NumericKeys];
+    bool indexOwners = false, indexStates = false, indexNames = false;
+    unordered_map<uid_t, vector<uint32_t>> rowsByUid;
+    vector<uint32_t> rowsByState[128];
+    vector<vector<uint32_t>> rowsByName;
+    vector<Firing> firings;
+
+    static int numericKey(const Condition &condition)
+    {
+        return condition.field == Field::Extra ? 5 + condition.metric : (int)condition.field;
+    }
+
+    static double value(const ProcessColumns &c, int key, uint32_t row)
+    {
+        switch (key)
+        {
+        case (int)Field::Cpu:
+            return c.cpu[row];
+        case (int)Field::Memory:
+            return c.memory[row];
+        case (int)Field::Priority:
+            return c.priority[row];
+        case (int)Field::Pid:
+            return c.pid[row];
+        case (int)Field::Ppid:
+            return c.ppid[row];
+        default:
+            return c.extra[key - 5][row];
+        }
+    }
+
+    static bool test(const ProcessColumns &c, const Condition &condition, uint32_t row)
+    {
+        switch (condition.field)
+        {
+        case Field::Name:
+            return condition.nameMatches[c.nameId[row]] != (condition.op == Op::NotEqual);
+        case Field::Owner:
+            return (c.uid[row] == condition.uid) == (condition.op == Op::Equal);
+        case Field::State:
+            return (c.state[row] == condition.state) == (condition.op == Op::Equal);
+        default:
+        {
+            double v = value(c, numericKey(condition), row);
+            switch (condition.op)
+            {
+            case Op::Greater:
+                return v > condition.number;
+            case Op::GreaterEqual:
+                return v >= condition.number;
+            case Op::Less:
+                return v < condition.number;
+            case Op::LessEqual:
+                return v <= condition.number;
+            case Op::Equal:
+                return v == condition.number;
+            default:
+                return v != condition.number;
+            }
+        }
+        }
+    }
+
+    static bool parseDuration(const string &text, double &seconds)
+    {
+        const char *end = text.data() + text.size();
+        auto [unit, ec] = from_chars(text.data(), end, seconds);
+        if (ec != errc() || seconds < 0)
+            return false;
+        string suffix(unit, end);
+        if (suffix == "ms")
+            seconds /= 1000;
+        else if (suffix == "m")
+            seconds *= 60;
+        else if (suffix == "h")
+            seconds *= 3600;
+        else if (suffix != "s" && !suffix.empty())
+            return false;
+        return true;
+    }
+
+    static bool parseCondition(const string &field, const string &op, const string &text, Condition &condition, string &error)
+    {
+        static const pair<const char *, Op> ops[] = {{">", Op::Greater}, {">=", Op::GreaterEqual}, {"<", Op::Less}, {"<=", Op::LessEqual}, {"==", Op::Equal}, {"=", Op::Equal}, {"!=", Op::NotEqual}, {"~", Op::Contains}};
+        auto found = find_if(begin(ops), end(ops), [&](const pair<const char *, Op> &entry)
+                             { return op == entry.first; });
+        if (found == end(ops))
+        {
+            error = "unknown operator '" + op + "'";
+            return false;
+        }
+        condition.op = found->second;
+        bool equality = condition.op == Op::Equal || condition.op == Op::NotEqual;
+
+        if (field == "name")
+        {
+            condition.field = Field::Name;
+            condition.text = text;
+            if (!equality && condition.op != Op::Contains)
+            {
+                error = "names compare with ==, != or ~";
+                return false;
+            }
+            return true;
+        }
+        if (field == "owner")
+        {
+            condition.field = Field::Owner;
+            if (!equality)
+            {
+                error = "owners compare with == or !=";
+                return false;
+            }
+            if (isNumeric(text))
+            {
+                // from_chars fails instead of wrapping on uids uid_t can't hold;
+                // -1 is the "no owner" marker of the rows
+                uid_t uid;
+                if (from_chars(text.data(), text.data() + text.size(), uid).ec != errc() || uid == (uid_t)-1)
+                {
+                    error = "uid " + text + " is out of range";
+                    return false;
+                }
+                condition.uid = uid;
+            }
+            else if (passwd *user = getpwnam(text.c_str())) // resolved once, rows are compared by uid
+                condition.uid = user->pw_uid;
+            else
+            {
+                error = "unknown user '" + text + "'";
+                return false;
+            }
+            return true;
+        }
+        if (field == "state")
+        {
+            condition.field = Field::State;
+            if (!equality || text.size() != 1)
+            {
+                error = "state compares with == or != against one letter (R, S, D, Z, T, ...)";
+                return false;
+            }
+            condition.state = text[0];
+            return true;
+        }
+
+        static const pair<const char *, Field> fields[] = {{"cpu", Field::Cpu}, {"memory", Field::Memory}, {"priority", Field::Priority}, {"pid", Field::Pid}, {"ppid", Field::Ppid}};
+        auto plain = find_if(begin(fields), end(fields), [&](const pair<const char *, Field> &entry)
+                             { return field == entry.first; });
+        const SortOption *extraOption = findSortOption(field);
+        if (plain != end(fields))
+            condition.field = plain->second;
+        else if (extraOption && extraOption->key >= SortKey::IoRead)
+        {
+            condition.field = Field::Extra;
+            condition.metric = (int)extraOption->key - (int)SortKey::IoRead;
+        }
+        else
+        {
+            error = "unknown column '" + field + "'";
+            return false;
+        }
+        if (condition.op == Op::Contains)
+        {
+            error = "~ only works on names";
+            return false;
+        }
+        if (from_chars(text.data(), text.data() + text.size(), condition.number).ec != errc() || text.empty())
+        {
+            error = "'" + text + "' is not a number";
+            return false;
+        }
+        if (condition.field == Field::Extra && condition.metric <= MetricSwap)
+            condition.number *= 1024; // given in the units shown: KB/s and MB
+        return true;
+    }
+
+    static unsigned conditionColumns(const Condition &condition)
+    {
+        switch (condition.field)
+        {
+        case Field::Cpu:
+            return ColumnCpu;
+        case Field::Memory:
+            return ColumnMemory;
+        case Field::Priority:
+            return ColumnPriority;
+        case Field::Pid:
+            return ColumnPid;
+        case Field::Ppid:
+            return ColumnPpid;
+        case Field::Extra:
+            return extraMetricColumn(condition.metric);
+        case Field::Name:
+            return ColumnName;
+        case Field::Owner:
+            return ColumnOwner;
+        default:
+            return ColumnState;
+        }
+    }
+
+    // once per snapshot: the indexes the conditions can be driven by, and the
+    // name matches of names not seen before
+    void buildIndexes(const ProcessColumns &c)
+    {
+        uint32_t rowCount = c.size();
+        for (int key = 0; key < NumericKeys; key++)
+        {
+            NumericIndex &index = numeric[key];
+            index.above.clear();
+            index.below.clear();
+            if (!index.wantAbove && !index.wantBelow)
+                continue;
+            for (uint32_t row = 0; row < rowCount; row++)
+            {
+                double v = value(c, key, row);
+                if (index.wantAbove && v >= index.aboveFrom)
+                    index.above.emplace_back(v, row);
+                if (index.wantBelow && v <= index.belowUpTo)
+                    index.below.emplace_back(v, row);
+            }
+            sort(index.above.begin(), index.above.end(), greater<pair<double, uint32_t>>());
+            sort(index.below.begin(), index.below.end());
+        }
+
+        if (indexOwners)
+        {
+            for (auto &[uid, rows] : rowsByUid)
+                rows.clear();
+            for (uint32_t row = 0; row < rowCount; row++)
+                rowsByUid[c.uid[row]].push_back(row);
+        }
+        if (indexStates)
+        {
+            for (vector<uint32_t> &rows : rowsByState)
+                rows.clear();
+            for (uint32_t row = 0; row < rowCount; row++)
+                rowsByState[(unsigned char)c.state[row] & 127].push_back(row);
+        }
+        if (indexNames)
+        {
+            for (vector<uint32_t> &rows : rowsByName)
+                rows.clear();
+            rowsByName.resize(c.nameCount());
+            for (uint32_t row = 0; row < rowCount; row++)
+                rowsByName[c.nameId[row]].push_back(row);
+        }
+
+        for (Rule &rule : rules)
+        {
+            for (Condition &condition : rule.conditions)
+            {
+                if (condition.field != Field::Name)
+                    continue;
+                if (condition.nameEpoch != c.nameEpoch || condition.nameMatches.size() > c.nameCount())
+                {
+                    condition.nameMatches.clear();
+                    condition.matchingNames.clear();
+                    condition.nameEpoch = c.nameEpoch;
+                }
+                for (uint32_t id = condition.nameMatches.size(); id < c.nameCount(); id++)
+                {
+                    const string &name = c.nameById(id);
+                    bool match = condition.op == Op::Contains ? name.find(condition.text) != string::npos : name == condition.text;
+                    condition.nameMatches.push_back(match);
+                    if (match)
+                        condition.matchingNames.push_back(id);
+                }
+            }
+        }
+    }
+
+    // how many rows a condition narrows the snapshot down to, SIZE_MAX if it
+    // has no index (!= and numeric ==)
+    size_t candidateCount(const Condition &condition) const
+    {
+        switch (condition.field)
+        {
+        case Field::Owner:
+        {
+            if (condition.op != Op::Equal)
+                return SIZE_MAX;
+            auto it = rowsByUid.find(condition.uid);
+            return it == rowsByUid.end() ? 0 : it->second.size();
+        }
+        case Field::State:
+            return condition.op == Op::Equal ? rowsByState[(unsigned char)condition.state & 127].size() : SIZE_MAX;
+        case Field::Name:
+        {
+            if (condition.op == Op::NotEqual)
+                return SIZE_MAX;
+            size_t count = 0;
+            for (uint32_t id : condition.matchingNames)
+                count += id < rowsByName.size() ? rowsByName[id].size() : 0;
+            return count;
+        }
+        default:
+            break;
+        }
+        const NumericIndex &index = numeric[numericKey(condition)];
+        double number = condition.number;
+        switch (condition.op)
+        {
+        case Op::Greater:
+            return partition_point(index.above.begin(), index.above.end(), [number](const pair<double, uint32_t> &entry)
+                                   { return entry.first > number; }) - index.above.begin();
+        case Op::GreaterEqual:
+            return partition_point(index.above.begin(), index.above.end(), [number](const pair<double, uint32_t> &entry)
+                                   { return entry.first >= number; }) - index.above.begin();
+        case Op::Less:
+            return partition_point(index.below.begin(), index.below.end(), [number](const pair<double, uint32_t> &entry)
+                                   { return entry.first < number; }) - index.below.begin();
+        case Op::LessEqual:
+            return partition_point(index.below.begin(), index.below.end(), [number](const pair<double, uint32_t> &entry)
+                                   { return entry.first <= number; }) - index.below.begin();
+        default:
+            return SIZE_MAX;
+        }
+    }
+
+    // calls visit(row) for the first `count` candidates of an indexed condition
+    template <typename Visit>
+    void forEachCandidate(const Condition &condition, size_t count, Visit visit) const
+    {
+        switch (condition.field)
+        {
+        case Field::Owner:
+        {
+            auto it = rowsByUid.find(condition.uid); // missing when the user has no processes
+            if (it != rowsByUid.end())
+                for (uint32_t row : it->second)
+                    visit(row);
+            return;
+        }
+        case Field::State:
+            for (uint32_t row : rowsByState[(unsigned char)condition.state & 127])
+                visit(row);
+            return;
+        case Field::Name:
+            for (uint32_t id : condition.matchingNames)
+                if (id < rowsByName.size())
+                    for (uint32_t row : rowsByName[id])
+                        visit(row);
+            return;
+        default:
+            break;
+        }
+        const NumericIndex &index = numeric[numericKey(condition)];
+        const vector<pair<double, uint32_t>> &sorted = condition.op == Op::Greater || condition.op == Op::GreaterEqual ? index.above : index.below;
+        for (size_t i = 0; i < count; i++)
+            visit(sorted[i].second);
+    }
+
+    void writeLog(const string &line)
+    {
+        if (logFile.is_open())
+            logFile << line << endl;
+        else
+            cout << COLOR_LABEL "[watch] " COLOR_RESET << line << endl;
+    }
+
+public:
+    // compiles the rules of a config file. on an error nothing changes and
+    // error names the line.
+    bool load(const string &path, string &error)
+    {
+        ifstream file(path);
+        if (!file)
+        {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        vector<Rule> loaded;
+        string newLogPath;
+        string line;
+        for (int lineNumber = 1; getline(file, line); lineNumber++)
+        {
+            size_t comment = line.find('#');
+            if (comment != string::npos)
+                line.erase(comment);
+            stringstream words(line);
+            string first, second, rest;
+            if (!(words >> first))
+                continue;
+            if (first == "log" && words >> second && !(words >> rest))
+            {
+                newLogPath = second;
+                continue;
+            }
+            Rule rule;
+            rule.name = "rule " + to_string(lineNumber);
+            string ruleError;
+            if (!parseRule(line, rule, ruleError))
+            {
+                error = path + ":" + to_string(lineNumber) + ": " + ruleError;
+                return false;
+            }
+            loaded.push_back(std::move(rule));
+        }
+        if (loaded.empty())
+        {
+            error = path + ": no rules";
+            return false;
+        }
+        if (!newLogPath.empty())
+        {
+            ofstream newLog(newLogPath, ios::app);
+            if (!newLog)
+            {
+                error = newLogPath + ": " + strerror(errno);
+                return false;
+            }
+            logFile = std::move(newLog);
+        }
+        else
+            logFile.close();
+        logPath = newLogPath;
+        rules = std::move(loaded);
+
+        // which indexes the snapshots need, and what the refreshes have to read
+        columns = 0;
+        indexOwners = indexStates = indexNames = false;
+        for (NumericIndex &index : numeric)
+            index = NumericIndex();
+        for (const Rule &rule : rules)
+        {
+            for (const Condition &condition : rule.conditions)
+            {
+                columns |= conditionColumns(condition);
+                indexOwners |= condition.field == Field::Owner;
+                indexStates |= condition.field == Field::State;
+                indexNames |= condition.field == Field::Name;
+                if (condition.field == Field::Name || condition.field == Field::Owner || condition.field == Field::State)
+                    continue;
+                NumericIndex &index = numeric[numericKey(condition)];
+                if (condition.op == Op::Greater || condition.op == Op::GreaterEqual)
+                {
+                    index.aboveFrom = index.wantAbove ? min(index.aboveFrom, condition.number) : condition.number;
+                    index.wantAbove = true;
+                }
+                else if (condition.op == Op::Less || condition.op == Op::LessEqual)
+                {
+                    index.belowUpTo = index.wantBelow ? max(index.belowUpTo, condition.number) : condition.number;
+                    index.wantBelow = true;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool parseRule(const string &line, Rule &rule, string &error)
+    {
+        // operators may be written without spaces ("cpu>90")
+        string spaced;
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            bool isOp = strchr("<>=!~", line[i]) != nullptr;
+            bool wasOp = i > 0 && strchr("<>=!~", line[i - 1]) != nullptr;
+            if (isOp != wasOp && i > 0)
+                spaced += ' ';
+            spaced += line[i];
+        }
+        vector<string> words;
+        stringstream stream(spaced);
+        for (string word; stream >> word;)
+            words.push_back(word);
+        rule.text = line;
+
+        size_t i = 0;
+        if (!words.empty() && words[0].back() == ':')
+            rule.name = words[i++].substr(0, words[0].size() - 1);
+        while (true)
+        {
+            if (i + 2 >= words.size())
+            {
+                error = "expected 'column operator value'";
+                return false;
+            }
+            Condition condition;
+            if (!parseCondition(words[i], words[i + 1], words[i + 2], condition, error))
+                return false;
+            rule.conditions.push_back(std::move(condition));
+            i += 3;
+            if (i < words.size() && words[i] == "and")
+                i++;
+            else
+                break;
+        }
+        while (i + 1 < words.size() && (words[i] == "for" || words[i] == "clear"))
+        {
+            if (!parseDuration(words[i + 1], words[i] == "for" ? rule.forSeconds : rule.clearSeconds))
+            {
+                error = "invalid duration '" + words[i + 1] + "'";
+                return false;
+            }
+            i += 2;
+        }
+        if (i >= words.size() || words[i] != "then")
+        {
+            error = "expected 'then' and an action";
+            return false;
+        }
+        for (i++; i < words.size() && words[i] != "limit"; i++)
+        {
+            string word = words[i];
+            replace(word.begin(), word.end(), '/', ',');
+            stringstream actions(word);
+            for (string action; getline(actions, action, ',');)
+            {
+                transform(action.begin(), action.end(), action.begin(), ::tolower);
+                if (action == "log")
+                    rule.log = true;
+                else if (action == "term" || action == "sigterm")
+                    rule.signal = SIGTERM;
+                else if (action == "kill" || action == "sigkill")
+                    rule.signal = SIGKILL;
+                else if (action == "stop" || action == "sigstop")
+                    rule.signal = SIGSTOP;
+                else if (!action.empty())
+                {
+                    error = "unknown action '" + action + "' (log, term, kill or stop)";
+                    return false;
+                }
+            }
+        }
+        if (!rule.log && !rule.signal)
+        {
+            error = "expected an action after 'then'";
+            return false;
+        }
+        if (i < words.size())
+        {
+            // "limit N per 60s"
+            if (i + 4 != words.size() || !isNumeric(words[i + 1]) || words[i + 2] != "per" || !parseDuration(words[i + 3], rule.limitSeconds))
+            {
+                error = "expected 'limit N per duration' at the end";
+                return false;
+            }
+            // 0 would suppress every firing
+            const string &limitText = words[i + 1];
+            if (from_chars(limitText.data(), limitText.data() + limitText.size(), rule.limit).ec != errc() || rule.limit == 0)
+            {
+                error = "the limit has to be a count of at least 1";
+                return false;
+            }
+        }
+        return true;
+    }
 
-    string getUsernameFromUid(const string &uidStr)
+    // checks every rule against a snapshot and carries out the actions of
+    // the ones that fire. now is in seconds, on any monotonic clock.
+    void check(const ProcessColumns &c, const ProcessTable &table, double now)
     {
-        try
         {
-            uid_t uid = stoi(uidStr);          // convert the uid to an integer
-            struct passwd *pw = getpwuid(uid); // get the user's name
-            if (pw != nullptr)                 // if the user's name is not null
+            PhaseTimer timer(Phase::Watchdog);
+            evaluate(c, now);
+        }
+        if (!firings.empty())
+            act(c, table);
+    }
+
+    void evaluate(const ProcessColumns &c, double now)
+    {
+        tick++;
+        firings.clear();
+        buildIndexes(c);
+        for (size_t r = 0; r < rules.size(); r++)
+        {
+            Rule &rule = rules[r];
+            const Condition *driver = nullptr;
+            size_t driverCount = SIZE_MAX;
+            for (const Condition &condition : rule.conditions)
+            {
+                size_t count = candidateCount(condition);
+                if (count < driverCount)
+                {
+                    driver = &condition;
+                    driverCount = count;
+                }
+            }
+
+            auto match = [&](uint32_t row)
+            {
+                for (const Condition &condition : rule.conditions)
+                    if (!test(c, condition, row))
+                        return;
+                auto [it, inserted] = rule.pending.try_emplace(c.pid[row], Pending{now, now, tick, false});
+                Pending &pending = it->second;
+                if (!inserted && c.change[row] == ChangeKind::Added)
+                    pending = Pending{now, now, tick, false}; // a new process with the same pid
+                pending.lastTrue = now;
+                pending.tick = tick;
+                if (!pending.fired && now - pending.since >= rule.forSeconds)
+                {
+                    while (!rule.firedAt.empty() && now - rule.firedAt.front() >= rule.limitSeconds)
+                        rule.firedAt.pop_front();
+                    if (rule.firedAt.size() >= rule.limit)
+                    {
+                        rule.suppressed++; // stays pending, fires once the limit allows it
+                        return;
+                    }
+                    rule.firedAt.push_back(now);
+                    rule.fired++;
+                    pending.fired = true;
+                    firings.push_back(Firing{r, row, now - pending.since});
+                }
+            };
+            if (driver)
+                forEachCandidate(*driver, driverCount, match);
+            else
+                for (uint32_t row = 0; row < c.size(); row++)
+                    match(row);
+
+            // hysteresis: a process that has fired only re-arms after its
+            // conditions were false for the clear duration
+            for (auto it = rule.pending.begin(); it != rule.pending.end();)
             {
-                return string(pw->pw_name); // return the user's name
+                const Pending &pending = it->second;
+                bool drop = pending.tick != tick && (!pending.fired || now - pending.lastTrue >= rule.clearSeconds);
+                it = drop ? rule.pending.erase(it) : next(it);
             }
         }
-        catch (...)
+    }
+
+    void act(const ProcessColumns &c, const ProcessTable &table)
+    {
+        string timestamp = formatTimestamp(chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+        char line[512];
+        for (const Firing &firing : firings)
         {
-            cout << "Error converting UID to integer or getting username." << endl;
+            const Rule &rule = rules[firing.rule];
+            int pid = c.pid[firing.row];
+            string outcome = "logged";
+            if (rule.signal)
+            {
+                const Process *proc = table.find(pid);
+                SignalBatch batch;
+                batch.add(pid, proc ? proc->getStartTime() : SignalBatch::currentStartTime(pid), c.name(firing.row));
+                string error;
+                if (!batch.signalOnly(rule.signal, error))
+                    outcome = error;
+                else
+                    outcome = string(strsignal(rule.signal)) + ": " + SignalBatch::describe(batch.getTargets()[0].outcome);
+            }
+            if (!rule.log)
+                continue;
+            snprintf(line, sizeof(line), "%s %s: PID %d (%s, cpu %.1f%%, memory %.1f%%) for %.0fs: %s",
+                     timestamp.c_str(), rule.name.c_str(), pid, c.name(firing.row).c_str(), c.cpu[firing.row],
+                     c.memory[firing.row], firing.heldSeconds, outcome.c_str());
+            writeLog(line);
         }
-        return "unknown";
     }
 
-    double getTotalSystemMemory()
+    bool empty() const { return rules.empty(); }
+    const vector<Rule> &getRules() const { return rules; }
+    unsigned getColumns() const { return columns; }
+    const string &getLogPath() const { return logPath; }
+
+    void clear()
+    {
+        rules.clear();
+        columns = 0;
+        logFile.close();
+        logPath.clear();
+    }
+};
+
+// the collector loop of batch mode, appending snapshots to a capture file
+int runRecord(const BatchOptions &options, ProcessTable &processTable)
+{
+    CaptureWriter writer;
+    string error;
+    if (!writer.open(options.outputPath, processTable.getCpuCount(), error))
+    {
+        cerr << "Cannot record to " << options.outputPath << ": " << error << endl;
+        return 1;
+    }
+
+    ProcessColumns columns;
+    processTable.refresh();
+    auto nextTick = chrono::steady_clock::now();
+    for (long tick = 0; running && (options.count == 0 || tick < options.count); tick++)
     {
-        ifstream meminfo("/proc/meminfo"); // open the meminfo file
-        string line;
-        double totalMem = 0.0;
-        if (getline(meminfo, line))
+        nextTick += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(options.interval));
+        this_thread::sleep_until(nextTick);
+        if (!running)
+            break;
+
+        const SnapshotDiff &diff = processTable.refresh();
+        columns.build(processTable);
+        uint64_t timestampMs = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count();
+        if (!writer.append(columns, diff, timestampMs))
         {
-            stringstream ss(line); // create a stringstream object
-            string label;
-            ss >> label >> totalMem; // read the label and total memory
+            perror("Error writing the capture");
+            return 1;
         }
-        return totalMem; // return the total memory
     }
+    return 0;
+}
+
+// ---- benchmarks ----
 
-    int getCpuCount()
+// the stringstream/vector<string> tokenizer that fetchProcessDetails() used
+// before parseStatLine(), kept so the benchmark has something to compare with
+bool parseStatLineLegacy(const string &statLine, string &name, StatFields &fields)
+{
+    size_t firstParen = statLine.find('(');
+    size_t lastParen = statLine.rfind(')');
+    if (firstParen == string::npos || lastParen == string::npos)
+        return false;
+
+    name = statLine.substr(firstParen + 1, lastParen - firstParen - 1);
+    string restOfStat = statLine.substr(lastParen + 2);
+    stringstream ss(restOfStat);
+    vector<string> values;
+    string token;
+    while (ss >> token)
+        values.push_back(token);
+
+    if (values.size() < 22)
+        return false;
+    fields.state = values[0][0];
+    fields.ppid = stoi(values[1]);
+    fields.utime = stoul(values[11]);
+    fields.stime = stoul(values[12]);
+    fields.priority = stoi(values[16]);
+    fields.numThreads = stol(values[17]);
+    fields.starttime = stoull(values[19]);
+    return true;
+}
+
+// parses recorded stat lines with both parsers and prints ns per line.
+// the lines come from linesFile (one stat line per line) if given, otherwise
+// they are recorded from the live /proc.
+int runParseBenchmark(const string &linesFile)
+{
+    vector<string> lines;
+    if (!linesFile.empty())
     {
-        ifstream cpuinfo("/proc/cpuinfo");
+        ifstream input(linesFile);
         string line;
-        int cpuCount = 0;
-
-        while (getline(cpuinfo, line))
+        while (getline(input, line))
+            if (!line.empty())
+                lines.push_back(line);
+    }
+    else
+    {
+        DIR *procDir = opendir(procRoot.c_str());
+        struct dirent *entry;
+        char buffer[4096];
+        while (procDir && (entry = readdir(procDir)) != NULL)
         {
-            if (line.find("processor") == 0)
-            {
-                cpuCount++;
-            }
+            if (isNumeric(entry->d_name) && readProcFile(atoi(entry->d_name), "stat", buffer, sizeof(buffer)) > 0)
+                lines.push_back(buffer);
         }
-        return cpuCount > 0 ? cpuCount : 1;
+        if (procDir)
+            closedir(procDir);
+        // awkward names the parser has to cope with
+        lines.push_back("4242 (tmux: server) S 1 4242 4242 0 -1 4194368 913 0 0 0 1520 388 0 0 20 0 1 0 7781 11812864 1161 18446744073709551615 1 1 0 0 0 0 0 4096 134430215 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n");
+        lines.push_back("4243 (odd) name)) R 4242 4243 4242 34816 4243 4194304 95 0 0 0 1 0 0 0 20 0 1 0 7790 8474624 844 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n");
     }
-
-    void fetchProcessDetails()
+    if (lines.empty())
     {
-        name = "N/A";
-        priority = 0;
-        memoryUsage = 0;
-        status = '?';
-        owner = "N/A";
-        ppid = 0;
-        cpuUsage = 0.0;
+        cout << "No stat lines to parse." << endl;
+        return 1;
+    }
 
-        long clk_tck = sysconf(_SC_CLK_TCK); // clock ticks per second
+    const size_t targetParses = 2000000;
+    size_t rounds = max<size_t>(1, targetParses / lines.size());
+    unsigned long long checksum = 0; // keeps the optimizer from dropping the work
 
-        string statFilePath = "/proc/" + to_string(pid) + "/stat"; // path for the stat file
-        ifstream statFile(statFilePath);                           // open the stat file
-        string statLine;                                           // line to hold the stat file content
-        if (getline(statFile, statLine))
-        {
-            size_t firstParen = statLine.find('('); // we find the first and last parentheses as the processName is inside the parentheses
-            size_t lastParen = statLine.rfind(')');
+    StatFields fields;
+    string name;
+    auto legacyStart = chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+        for (const string &line : lines)
+            if (parseStatLineLegacy(line, name, fields))
+                checksum += fields.utime + name.size();
+    auto legacyEnd = chrono::steady_clock::now();
 
-            if (firstParen != string::npos && lastParen != string::npos) // we check if the parentheses are found
-            {
-                // extract process name
-                name = statLine.substr(firstParen + 1, lastParen - firstParen - 1);
+    for (size_t round = 0; round < rounds; round++)
+        for (const string &line : lines)
+            if (parseStatLine(line.data(), line.size(), fields))
+                checksum -= fields.utime + fields.commLength;
+    auto newEnd = chrono::steady_clock::now();
 
-                // Remove any spaces in the name
-                name.erase(remove(name.begin(), name.end(), ' '), name.end());
-            }
-            {
-                string restOfStat = statLine.substr(lastParen + 2); // take the rest of the information after the name
-                stringstream ss(restOfStat);                        // create a stringstream object for the rest of the information
-                vector<string> values;                              // store all the values in a vector
-                string token;
+    double parses = (double)rounds * lines.size();
+    double legacyNs = chrono::duration<double, nano>(legacyEnd - legacyStart).count() / parses;
+    double newNs = chrono::duration<double, nano>(newEnd - legacyEnd).count() / parses;
 
-                while (ss >> token)
-                    values.push_back(token);
+    cout << "Parsed " << lines.size() << " stat lines x " << rounds << " rounds" << endl;
+    cout << fixed << setprecision(1);
+    cout << "  stringstream tokenizer: " << setw(8) << legacyNs << " ns/line" << endl;
+    cout << "  parseStatLine:          " << setw(8) << newNs << " ns/line" << endl;
+    cout << "  speedup:                " << setw(8) << legacyNs / newNs << "x" << endl;
+    if (checksum != 0) // both parsers must agree on every line
+    {
+        cout << "Warning: parsers disagree (checksum " << checksum << ")" << endl;
+        return 1;
+    }
+    return 0;
+}
 
-                if (values.size() >= 22)
-                {
-                    status = values[0][0];                       // 3rd field: process state
-                    ppid = stoi(values[1]);                      // 4th field: parent PID
-                    utimeCurrent = stoul(values[11]);            // 14th field
-                    stimeCurrent = stoul(values[12]);            // 15th field
-                    priority = stoi(values[16]);                 // 18th field
-                    unsigned long starttime = stoul(values[19]); // 22nd field
+// p in [0, 100]; sorts the samples
+double percentile(vector<double> &samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+    sort(samples.begin(), samples.end());
+    size_t index = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[min(index, samples.size() - 1)];
+}
 
-                    // Read uptime from /proc/uptime
-                    ifstream uptimeFile("/proc/uptime");
-                    string uptimeLine;
-                    if (getline(uptimeFile, uptimeLine))
-                    {
-                        stringstream uptimeStream(uptimeLine);
-                        double uptimeSeconds = 0.0;
-                        uptimeStream >> uptimeSeconds;
-
-                        double totalCPUTime = utimeCurrent + stimeCurrent;              // calculate total CPU time used to know how much CPU time the process consumedd in user and kernel modes
-                        double seconds = uptimeSeconds - (starttime / (double)clk_tck); // calculate the time since the process started
-                        if (seconds > 0)
-                            cpuUsage = 100.0 * ((totalCPUTime / clk_tck) / seconds);
-                    }
-                }
-            }
+// forks `population` idle children so there is a known number of extra pids,
+// then times a cold refresh (empty table, every Process allocated) and warm
+// refreshes (updated in place) with 1, 2, 4 ... maxThreads scan threads
+int runScanBenchmark(size_t population, size_t maxThreads)
+{
+    vector<pid_t> children;
+    for (size_t i = 0; i < population; i++)
+    {
+        pid_t child = fork();
+        if (child == 0)
+        {
+            prctl(PR_SET_PDEATHSIG, SIGKILL); // don't outlive the benchmark
+            pause();
+            _exit(0);
         }
-        statFile.close();
-
-        string statusFilePath = "/proc/" + to_string(pid) + "/status"; // status path to calculate memory usage
-        ifstream statusFile(statusFilePath);
-        if (statusFile.is_open())
+        if (child < 0)
         {
-            string line;
-            while (getline(statusFile, line))
-            {
-                if (line.find("Uid:") == 0) // if we find UID at the very beginning of the line
-                {
-                    string uidStr = line.substr(5);
-                    size_t tabPos = uidStr.find('\t');
-                    if (tabPos != string::npos)
-                    {
-                        uidStr = uidStr.substr(0, tabPos);
-                    }
-                    owner = getUsernameFromUid(uidStr);
-                }
-                else if (line.find("VmRSS:") == 0)
-                {
-                    double memKB = stod(line.substr(7)); // convert the memory usage to double
-                    double totalMem = getTotalSystemMemory();
-                    if (totalMem > 0)
-                    {
-                        memoryUsage = (memKB / totalMem) * 100.0;
-                    }
-                }
-            }
+            perror("fork");
+            break;
         }
-        statusFile.close();
+        children.push_back(child);
     }
 
-public:
-    Process(int p)
+    vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    const int warmRuns = 10;
+    double baseline = 0.0;
+    cout << "Scanning " << children.size() << " synthetic processes (plus the rest of /proc)" << endl;
+    cout << left << setw(10) << "Threads" << setw(16) << "Cold (ms)" << setw(20) << "Warm median (ms)" << "Speedup" << endl;
+    cout << fixed << setprecision(2);
+    for (size_t threads : threadCounts)
     {
-        pid = p;
-        fetchProcessDetails();
-    }
+        ProcessTable table(threads);
+        auto coldStart = chrono::steady_clock::now();
+        table.refresh();
+        double coldMs = chrono::duration<double, milli>(chrono::steady_clock::now() - coldStart).count();
 
-    int getPID() const { return pid; }
-    const string &getName() const { return name; }
-    double getMemoryUsage() const { return memoryUsage; }
-    const string &getOwner() const { return owner; }
-    int getParentPID() const { return ppid; }
-    const string &getStatus() const { return status; }
-    int getPriority() const { return priority; }
-    double getCPUUsage() const { return cpuUsage; }
-};
+        vector<double> warm;
+        for (int run = 0; run < warmRuns; run++)
+        {
+            auto start = chrono::steady_clock::now();
+            table.refresh();
+            warm.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        double warmMs = percentile(warm, 50);
+        if (threads == 1)
+            baseline = warmMs;
+        cout << setw(10) << threads << setw(16) << coldMs << setw(20) << warmMs << baseline / warmMs << "x" << endl;
+    }
 
-bool running = true;           // flag for controlling auto-refresh
-void signalHandler(int signum) // signal handler for Ctrl+C
-{
-    running = false;
+    for (pid_t child : children)
+        kill(child, SIGKILL);
+    for (pid_t child : children)
+        waitpid(child, nullptr, 0);
+    return 0;
 }
 
-void clearScreen() // clear the screen function
+// runs the same number of refreshes with the fd cache off (open/read/close
+// per file) and on (pread on cached fds), each with plain syscalls and through
+// io_uring, and compares the /proc operations and syscalls they made
+int runSyscallBenchmark(size_t refreshes)
 {
-    cout << "\033[2J\033[1;1H"; // escape sequence to clear screen
+    string error;
+    bool ioUring = probeIoUring(error);
+    cout << "Refreshing " << refreshes << " times with and without the fd cache";
+    if (ioUring)
+        cout << " and io_uring" << endl;
+    else
+        cout << " (io_uring unavailable: " << error << ")" << endl;
+    cout << left << setw(22) << "mode" << setw(12) << "opens" << setw(12) << "reads" << setw(12) << "closes"
+         << setw(14) << "syscalls" << "ms / refresh" << endl;
+    cout << fixed << setprecision(2);
+    for (bool uring : {false, true})
+    {
+        for (bool cached : {false, true})
+        {
+            if (uring && !ioUring)
+                continue;
+            Process::fdCacheEnabled = cached;
+            ProcessTable table;
+            if (uring)
+                table.enableIoUring(error);
+            table.refresh(); // the first refresh opens everything either way
+
+            uint64_t opens = procReadCounters.opens, reads = procReadCounters.reads, closes = procReadCounters.closes,
+                     submits = procReadCounters.submits;
+            auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < refreshes; i++)
+                table.refresh();
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / refreshes;
+
+            double perRefresh[4] = {(double)(procReadCounters.opens - opens) / refreshes,
+                                    (double)(procReadCounters.reads - reads) / refreshes,
+                                    (double)(procReadCounters.closes - closes) / refreshes,
+                                    (double)(procReadCounters.submits - submits) / refreshes};
+            // through the ring the opens, reads and closes of a chunk share a few io_uring_enter calls
+            double syscalls = uring ? perRefresh[3] : perRefresh[0] + perRefresh[1] + perRefresh[2];
+            cout << setw(22) << string(uring ? "io_uring, " : "") + (cached ? "cache on" : "cache off") << setw(12) << perRefresh[0]
+                 << setw(12) << perRefresh[1] << setw(12) << perRefresh[2] << setw(14) << syscalls << ms << endl;
+        }
+    }
+    cout << "(per refresh, counting the per-pid stat/status reads; "
+         << fdBudget.getLimit() << " fds available to the cache)" << endl;
+    return 0;
 }
 
-bool isNumeric(const string &s)
+// writes a fake procfs tree under root: meminfo, uptime, stat and cpuinfo,
+// plus `processes` pid directories with stat, status, statm and io files
+// shaped like the kernel's. names, uids, parents and sizes vary so sorting,
+// grouping and the user cache have realistic work to do.
+bool writeProcFixture(const string &root, size_t processes, string &error, size_t threadsPerProcess = 0)
 {
-    if (s.empty())
+    auto writeFile = [&](const string &path, const char *data, size_t size)
+    {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = fd >= 0 && write(fd, data, size) == (ssize_t)size;
+        if (fd >= 0)
+            close(fd);
+        if (!ok)
+            error = path + ": " + strerror(errno);
+        return ok;
+    };
+
+    if (mkdir(root.c_str(), 0755) != 0 && errno != EEXIST)
     {
+        error = root + ": " + strerror(errno);
         return false;
     }
-    return std::all_of(s.begin(), s.end(), ::isdigit);
-}
+    string text = "MemTotal:       16318148 kB\nMemFree:         8123456 kB\nMemAvailable:   12345678 kB\n";
+    if (!writeFile(root + "/meminfo", text.data(), text.size()))
+        return false;
+    text = "123456.78 234567.89\n";
+    if (!writeFile(root + "/uptime", text.data(), text.size()))
+        return false;
+    text = "cpu  1234567 2345 345678 98765432 12345 0 6789 0 0 0\ncpu0 308641 586 86419 24691358 3086 0 1697 0 0 0\n"
+           "intr 123456789\nctxt 987654321\nbtime 1700000000\nprocesses 1234567\nprocs_running 2\nprocs_blocked 0\n";
+    if (!writeFile(root + "/stat", text.data(), text.size()))
+        return false;
+    text.clear();
+    for (int cpu = 0; cpu < 4; cpu++)
+        text += "processor\t: " + to_string(cpu) + "\nmodel name\t: Synthetic CPU\n\n";
+    if (!writeFile(root + "/cpuinfo", text.data(), text.size()))
+        return false;
 
-vector<unique_ptr<Process>> findProcesses()
-{
-    vector<unique_ptr<Process>> processesFound; // i use unique_ptr to manage memory automatically for automatic cleanup
+    static const char *const names[] = {"systemd", "kworker/0:1", "bash", "sshd", "nginx", "postgres", "python3",
+                                        "java", "node", "containerd-shim", "tmux: server", "chrome (renderer)"};
+    static const uid_t uids[] = {0, 0, 0, 1, 33, 101, 1000, 1000, 1001};
+    char buffer[2048];
+    unsigned long seed = 12345; // fixed, so every run measures the same tree
+    auto next = [&seed]()
+    {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        return (unsigned long)(seed >> 33);
+    };
 
-    DIR *processesDirectory = opendir("/proc"); // open /proc directory
-    if (!processesDirectory)
+    auto makeDir = [&](const string &dir)
     {
-        cout << "Error opening /proc directory" << endl;
-    }
+        if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            error = dir + ": " + strerror(errno);
+            return false;
+        }
+        return true;
+    };
 
-    struct dirent *entry; // directory entry (temporarily hold a pointer to a directory entry)
-    while ((entry = readdir(processesDirectory)) != NULL)
-    {                                // reads the next available entry
-        if (entry->d_type == DT_DIR) // check if the entry is a directory
+    for (size_t i = 0; i < processes; i++)
+    {
+        int pid = 100 + i;
+        int ppid = i == 0 ? 1 : 100 + next() % i;
+        const char *name = names[next() % (sizeof(names) / sizeof(names[0]))];
+        uid_t uid = uids[next() % (sizeof(uids) / sizeof(uids[0]))];
+        unsigned long utime = next() % 100000, stime = next() % 20000;
+        unsigned long rssPages = 100 + next() % 50000;
+        long threads = 1 + next() % 16;
+        if (threadsPerProcess > 0)
+            threads = threadsPerProcess;
+        string dir = root + "/" + to_string(pid);
+        if (!makeDir(dir))
+            return false;
+
+        unsigned long long start = 1000 + next() % 1000000;
+        auto statLine = [&](int id, unsigned long user, unsigned long system)
+        {
+            return snprintf(buffer, sizeof(buffer),
+                            "%d (%s) S %d %d %d 0 -1 4194560 %lu 0 12 0 %lu %lu 0 0 20 %ld %ld 0 %llu %lu %lu "
+                            "18446744073709551615 1 1 0 0 0 0 0 4096 134234626 0 0 0 17 %zu 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+                            id, name, ppid, pid, pid, next() % 5000, user, system, (long)(next() % 40) - 20, threads,
+                            start, rssPages * 40960, rssPages, i % 4);
+        };
+        int length = statLine(pid, utime, stime);
+        if (!writeFile(dir + "/stat", buffer, length))
+            return false;
+
+        // task/<tid>/stat per thread: the main thread has the pid, the others
+        // get ids above every pid of the fixture
+        if (threadsPerProcess > 0)
         {
-            string dirName(entry->d_name); // convert to string
-            if (isNumeric(dirName))
+            if (!makeDir(dir + "/task"))
+                return false;
+            for (size_t t = 0; t < threadsPerProcess; t++)
             {
-                int pid = stoi(dirName); // convert to int
-                if (pid > 0)
-                {
-                    processesFound.push_back(unique_ptr<Process>(new Process(pid))); // create a new Process object and add it to the vector
-                }
+                int tid = t == 0 ? pid : 100 + processes + i * (threadsPerProcess - 1) + (t - 1);
+                string taskDir = dir + "/task/" + to_string(tid);
+                length = statLine(tid, utime / threadsPerProcess, stime / threadsPerProcess);
+                if (!makeDir(taskDir) || !writeFile(taskDir + "/stat", buffer, length))
+                    return false;
             }
         }
+
+        length = snprintf(buffer, sizeof(buffer),
+                          "Name:\t%s\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\nNgid:\t0\nPid:\t%d\nPPid:\t%d\n"
+                          "TracerPid:\t0\nUid:\t%u\t%u\t%u\t%u\nGid:\t%u\t%u\t%u\t%u\nFDSize:\t64\nGroups:\t%u\n"
+                          "NStgid:\t%d\nNSpid:\t%d\nNSpgid:\t%d\nNSsid:\t%d\nVmPeak:\t%8lu kB\nVmSize:\t%8lu kB\n"
+                          "VmLck:\t       0 kB\nVmPin:\t       0 kB\nVmHWM:\t%8lu kB\nVmRSS:\t%8lu kB\nRssAnon:\t%8lu kB\n"
+                          "RssFile:\t%8lu kB\nRssShmem:\t       0 kB\nVmData:\t%8lu kB\nVmStk:\t     132 kB\nVmExe:\t     900 kB\n"
+                          "VmLib:\t    5000 kB\nVmPTE:\t     120 kB\nVmSwap:\t       0 kB\nHugetlbPages:\t       0 kB\n"
+                          "CoreDumping:\t0\nTHP_enabled:\t1\nThreads:\t%ld\nSigQ:\t0/63426\nSigPnd:\t0000000000000000\n"
+                          "ShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\nSigIgn:\t0000000000001000\n"
+                          "SigCgt:\t0000000180004a02\nCapInh:\t0000000000000000\nCapPrm:\t0000000000000000\n"
+                          "CapEff:\t0000000000000000\nCapBnd:\t000001ffffffffff\nCapAmb:\t0000000000000000\n"
+                          "NoNewPrivs:\t0\nSeccomp:\t0\nSpeculation_Store_Bypass:\tthread vulnerable\n"
+                          "Cpus_allowed:\tf\nCpus_allowed_list:\t0-3\nMems_allowed:\t1\nMems_allowed_list:\t0\n"
+                          "voluntary_ctxt_switches:\t%lu\nnonvoluntary_ctxt_switches:\t%lu\n",
+                          name, pid, pid, ppid, uid, uid, uid, uid, uid, uid, uid, uid, uid, pid, pid, pid, pid,
+                          rssPages * 40, rssPages * 40, rssPages * 4, rssPages * 4, rssPages * 3, rssPages, rssPages * 8,
+                          threads, next() % 100000, next() % 1000);
+        if (!writeFile(dir + "/status", buffer, length))
+            return false;
+
+        length = snprintf(buffer, sizeof(buffer), "%lu %lu %lu 225 0 %lu 0\n", rssPages * 10, rssPages, rssPages / 4, rssPages * 2);
+        if (!writeFile(dir + "/statm", buffer, length))
+            return false;
+
+        unsigned long readBytes = next() % 100000000, writeBytes = next() % 10000000;
+        length = snprintf(buffer, sizeof(buffer),
+                          "rchar: %lu\nwchar: %lu\nsyscr: %lu\nsyscw: %lu\nread_bytes: %lu\nwrite_bytes: %lu\ncancelled_write_bytes: 0\n",
+                          readBytes * 2, writeBytes * 2, readBytes / 4096, writeBytes / 4096, readBytes, writeBytes);
+        if (!writeFile(dir + "/io", buffer, length))
+            return false;
+
+        // one systemd service per name, for 'group cgroup'
+        string unit = name;
+        replace_if(unit.begin(), unit.end(), [](char ch)
+                   { return !isalnum((unsigned char)ch); }, '-');
+        length = snprintf(buffer, sizeof(buffer), "0::/system.slice/%s.service\n", unit.c_str());
+        if (!writeFile(dir + "/cgroup", buffer, length))
+            return false;
     }
-    closedir(processesDirectory); // close the directory
-    return processesFound;        // return the vector of processes
+    return true;
 }
 
-// ANSI color codes
-#define COLOR_RESET "\033[0m"
-#define COLOR_HEADER "\033[1;36m"    // Bold cyan
-#define COLOR_LABEL "\033[1;33m"     // Bold yellow
-#define COLOR_VALUE "\033[0;37m"     // Light gray
-#define COLOR_HIGHLIGHT "\033[1;32m" // Bold green
-
-void displayProcesses(const vector<unique_ptr<Process>> &processList)
+int removeFixtureEntry(const char *path, const struct stat *, int, struct FTW *)
 {
-    cout << left;
+    return remove(path);
+}
 
-    // Header section
-    cout << COLOR_HEADER;
-    cout << setw(8) << "PID"
-         << setw(8) << "PPID"
-         << setw(25) << "Name"
-         << setw(12) << "Owner"
-         << setw(12) << "Memory(%)"
-         << setw(10) << "CPU(%)"
-         << setw(8) << "Status"
-         << setw(10) << "Priority"
-         << COLOR_RESET << endl;
-
-    cout << COLOR_LABEL << string(93, '-') << COLOR_RESET << endl;
-
-    for (const auto &procPtr : processList)
-    {
-        if (!procPtr)
-            continue;
+// generates fixtures of 1k, 10k and 100k processes (or the given sizes) and
+// reports scan latency percentiles, heap allocations per refresh, and the time
+// to build, sort and render the full view, all against the fixture tree
+int runBenchmarkSuite(const vector<size_t> &sizes, size_t threads)
+{
+    char directory[] = "/tmp/lpm-fixture-XXXXXX";
+    if (!mkdtemp(directory))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    string savedRoot = procRoot;
+    bool ok = true;
 
-        // You can highlight high memory or CPU processes
-        bool isHighCPU = procPtr->getCPUUsage() > 10.0;
-        bool isHighMem = procPtr->getMemoryUsage() > 5.0;
+    cout << fixed << setprecision(2);
+    cout << left << setw(10) << "Processes" << setw(12) << "Cold (ms)" << setw(10) << "p50" << setw(10) << "p90"
+         << setw(10) << "p99" << setw(10) << "max" << setw(14) << "allocs/ref" << setw(12) << "view (ms)"
+         << "render (ms)" << endl;
+    for (size_t size : sizes)
+    {
+        string root = string(directory) + "/" + to_string(size);
+        string error;
+        if (!writeProcFixture(root, size, error))
+        {
+            cout << "Cannot write the fixture: " << error << endl;
+            ok = false;
+            break;
+        }
+        procRoot = root;
 
-        cout << setw(8) << procPtr->getPID()
-             << setw(8) << procPtr->getParentPID()
-             << setw(25) << procPtr->getName().substr(0, 24)
-             << setw(12) << procPtr->getOwner().substr(0, 11);
+        // enough refreshes for stable percentiles without taking minutes at 100k
+        size_t refreshes = max<size_t>(5, min<size_t>(100, 200000 / size));
+        ProcessTable table(threads);
+        auto coldStart = chrono::steady_clock::now();
+        table.refresh();
+        double coldMs = chrono::duration<double, milli>(chrono::steady_clock::now() - coldStart).count();
 
-        // Highlight memory and CPU if high
-        cout << fixed << setprecision(1);
-        if (isHighMem)
-            cout << COLOR_HIGHLIGHT;
-        cout << setw(12) << procPtr->getMemoryUsage();
-        cout << COLOR_RESET;
+        vector<double> latencies;
+        uint64_t allocations = heapAllocations;
+        for (size_t run = 0; run < refreshes; run++)
+        {
+            auto start = chrono::steady_clock::now();
+            table.refresh();
+            latencies.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+        }
+        double allocationsPerRefresh = (double)(heapAllocations - allocations) / refreshes;
 
-        if (isHighCPU)
-            cout << COLOR_HIGHLIGHT;
-        cout << setw(10) << procPtr->getCPUUsage();
-        cout << COLOR_RESET;
+        // columns + sort by cpu, then format every row and join the frame
+        ProcessColumns columns;
+        ViewSettings settings;
+        settings.sortBy = findSortOption("cpu");
+        settings.descending = true;
+        auto viewStart = chrono::steady_clock::now();
+        columns.build(table);
+        ProcessView view = buildView(columns, settings);
+        auto renderStart = chrono::steady_clock::now();
+        vector<string> lines;
+        formatProcesses(view, &table.getLastDiff(), lines);
+        string output;
+        for (const string &line : lines)
+            output += line + '\n';
+        auto renderEnd = chrono::steady_clock::now();
 
-        cout << setw(8) << procPtr->getStatus()
-             << setw(10) << procPtr->getPriority()
-             << endl;
+        cout << setw(10) << table.size() << setw(12) << coldMs << setw(10) << percentile(latencies, 50)
+             << setw(10) << percentile(latencies, 90) << setw(10) << percentile(latencies, 99)
+             << setw(10) << latencies.back() << setw(14) << allocationsPerRefresh
+             << setw(12) << chrono::duration<double, milli>(renderStart - viewStart).count()
+             << chrono::duration<double, milli>(renderEnd - renderStart).count() << endl;
     }
+    cout << "(refresh latencies in ms over the fixture in " << directory << ", " << threads << " scan thread(s))" << endl;
 
-    cout << COLOR_LABEL << string(93, '-') << COLOR_RESET << endl;
-    cout << COLOR_HEADER << "Total Processes: " << COLOR_VALUE << processList.size() << COLOR_RESET << endl
-         << endl;
+    procRoot = savedRoot;
+    nftw(directory, removeFixtureEntry, 64, FTW_DEPTH | FTW_PHYS);
+    return ok ? 0 : 1;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    size_t scanThreads = 1; // --threads N: parallel /proc scan
+    string benchmark;
+    string benchmarkArg;
+    bool batch = false;
+    bool useEvents = false; // --events: track pids with the proc connector
+    bool useIoUring = false; // --io-uring: read the per-pid files through io_uring
+    size_t historyDepth = 60; // --history N: refreshes kept per process, 0 turns the history off
+    size_t historyProcesses = 4096;
+    string recordPath; // --record file: append snapshots to a capture file instead of showing them
+    string replayPath; // --replay file: browse a capture file instead of /proc
+    string watchPath;  // --watch file: watchdog rules checked on every refresh
+    BatchOptions batchOptions;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc && argv[i + 1][0] != '-';
+        if (arg == "--threads" && hasValue)
+        {
+            scanThreads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--batch")
+        {
+            batch = true;
+        }
+        else if (arg == "--events")
+        {
+            useEvents = true;
+        }
+        else if (arg == "--history" && hasValue)
+        {
+            historyDepth = atol(argv[++i]);
+        }
+        else if (arg == "--record" && hasValue)
+        {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--replay" && hasValue)
+        {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--watch" && hasValue)
+        {
+            watchPath = argv[++i];
+        }
+        else if (arg == "--io-uring")
+        {
+            useIoUring = true;
+        }
+        else if (arg == "--no-fd-cache")
+        {
+            Process::fdCacheEnabled = false;
+        }
+        else if (arg == "--interval" && hasValue)
+        {
+            batchOptions.interval = max(0.01, atof(argv[++i]));
+        }
+        else if (arg == "--count" && hasValue)
+        {
+            batchOptions.count = atol(argv[++i]);
+        }
+        else if (arg == "--output" && hasValue)
+        {
+            batchOptions.outputPath = argv[++i];
+        }
+        else if (arg == "--format" && hasValue)
+        {
+            string format = argv[++i];
+            if (format == "jsonl")
+                batchOptions.format = BatchFormat::JsonLines;
+            else if (format == "csv")
+                batchOptions.format = BatchFormat::Csv;
+            else if (format == "bin")
+                batchOptions.format = BatchFormat::Binary;
+            else
+            {
+                cout << "Unknown format '" << format << "'. Use jsonl, csv or bin." << endl;
+                return 1;
+            }
+        }
+        else if (arg == "--proc-root" && hasValue)
+        {
+            procRoot = argv[++i];
+        }
+        else if (arg == "--make-fixture" && i + 2 < argc)
+        {
+            // --make-fixture dir processes [threads]: write a synthetic procfs tree to use with --proc-root,
+            // with a task directory of [threads] threads per process if given
+            string error;
+            string root = argv[i + 1];
+            size_t threadsPerProcess = i + 3 < argc && isNumeric(argv[i + 3]) ? atol(argv[i + 3]) : 0;
+            if (!writeProcFixture(root, atol(argv[i + 2]), error, threadsPerProcess))
+            {
+                cout << "Cannot write the fixture: " << error << endl;
+                return 1;
+            }
+            cout << "Wrote " << atol(argv[i + 2]) << " synthetic processes";
+            if (threadsPerProcess > 0)
+                cout << " with " << threadsPerProcess << " threads each";
+            cout << " to " << root << endl;
+            return 0;
+        }
+        else if (arg == "--bench-parse" || arg == "--bench-scan" || arg == "--bench-syscalls" || arg == "--bench-suite")
+        {
+            benchmark = arg;
+            if (hasValue)
+                benchmarkArg = argv[++i];
+        }
+        else
+        {
+            cout << "Usage: " << argv[0] << " [--threads N] [--events] [--io-uring] [--no-fd-cache] [--history refreshes] [--watch rules-file]\n"
+                 << "       " << argv[0] << " --batch [--interval seconds] [--format jsonl|csv|bin] [--count ticks] [--output file]\n"
+                 << "       " << argv[0] << " --record file [--interval seconds] [--count ticks] | --replay file\n"
+                 << "       " << argv[0] << " --bench-parse [stat-lines-file] | --bench-scan [processes] | --bench-syscalls [refreshes]\n"
+                 << "       " << argv[0] << " --bench-suite [sizes, e.g. 1000,10000,100000] | --make-fixture dir processes [threads]\n"
+                 << "       (any mode) --proc-root dir: read processes from dir instead of /proc" << endl;
+            return 1;
+        }
+    }
+
+    fdBudget.init();
+
+    if (benchmark == "--bench-parse")
+        return runParseBenchmark(benchmarkArg);
+    if (benchmark == "--bench-syscalls")
+        return runSyscallBenchmark(benchmarkArg.empty() ? 20 : max(1ul, stoul(benchmarkArg)));
+    if (benchmark == "--bench-suite")
+    {
+        vector<size_t> sizes;
+        stringstream list(benchmarkArg.empty() ? "1000,10000,100000" : benchmarkArg);
+        string size;
+        while (getline(list, size, ','))
+            if (isNumeric(size) && stoul(size) > 0)
+                sizes.push_back(stoul(size));
+        return runBenchmarkSuite(sizes, scanThreads);
+    }
+    if (procRoot != "/proc" && useEvents)
+    {
+        cout << "Process events describe the live system, not " << procRoot << "; ignoring --events." << endl;
+        useEvents = false;
+    }
+    if (benchmark == "--bench-scan")
+    {
+        size_t maxThreads = scanThreads > 1 ? scanThreads : max(1u, thread::hardware_concurrency());
+        return runScanBenchmark(benchmarkArg.empty() ? 2000 : stoul(benchmarkArg), maxThreads);
+    }
+
     signal(SIGINT, signalHandler); // Register signal handler for Ctrl+C
 
+    if (!recordPath.empty())
+    {
+        signal(SIGTERM, signalHandler);
+        userCache.reload();
+        ProcessTable processTable(scanThreads);
+        string error;
+        if (useEvents && !processTable.enableEvents(error))
+            cerr << "Process events unavailable, scanning /proc instead: " << error << endl;
+        if (useIoUring && !processTable.enableIoUring(error))
+            cerr << "io_uring unavailable, reading /proc synchronously: " << error << endl;
+        batchOptions.outputPath = recordPath;
+        return runRecord(batchOptions, processTable);
+    }
+
+    if (batch)
+    {
+        signal(SIGTERM, signalHandler); // collectors stop us with SIGTERM
+        signal(SIGPIPE, SIG_IGN);       // a closed pipe shows up as a write error instead
+        userCache.reload();
+        ProcessTable processTable(scanThreads);
+        string error;
+        if (useEvents && !processTable.enableEvents(error))
+            cerr << "Process events unavailable, scanning /proc instead: " << error << endl;
+        if (useIoUring && !processTable.enableIoUring(error))
+            cerr << "io_uring unavailable, reading /proc synchronously: " << error << endl;
+        return runBatch(batchOptions, processTable);
+    }
+
     cout << "--- Linux Process Lister ---" << endl;
 
+    EventLoop loop; // input, timers and Ctrl+C; before the table starts its threads
+    string loopError;
+    if (!loop.init(loopError))
+    {
+        cout << "Cannot set up the event loop: " << loopError << endl;
+        return 1;
+    }
+
     // get the initial list of processes
     cout << "Fetching process list..." << endl;
-    vector<unique_ptr<Process>> currentProcesses = findProcesses();
+    userCache.reload(); // warm the uid cache from /etc/passwd so the first scan skips most getpwuid() calls
+    ProcessTable processTable(scanThreads);
+    string eventsError;
+    if (useEvents && !processTable.enableEvents(eventsError))
+        cout << "Process events unavailable, scanning /proc instead: " << eventsError << endl;
+    string ioUringError;
+    if (useIoUring && !processTable.enableIoUring(ioUringError))
+        cout << "io_uring unavailable, reading /proc synchronously: " << ioUringError << endl;
+    ProcessColumns columns; // columnar copy of the table that sort/filter/group work on
+
+    // with --replay the snapshots come from a capture file instead of /proc:
+    // 'refresh' and 'auto' step through it and 'seek' jumps around in it
+    unique_ptr<CaptureReader> replay;
+    size_t replayPosition = 0;
+    SnapshotDiff replayDiff;
+    if (!replayPath.empty())
+    {
+        replay.reset(new CaptureReader());
+        string error;
+        if (!replay->open(replayPath, error))
+        {
+            cout << "Cannot replay: " << error << endl;
+            return 1;
+        }
+        cout << "Replaying " << replay->size() << " snapshots from " << formatTimestamp(replay->timestamp(0))
+             << " to " << formatTimestamp(replay->timestamp(replay->size() - 1)) << "." << endl;
+    }
+    auto rebuildColumns = [&]()
+    {
+        if (replay)
+            replay->load(replayPosition, columns, replayDiff);
+        else
+            columns.build(processTable);
+    };
+    auto lastDiff = [&]()
+    {
+        return replay ? &replayDiff : &processTable.getLastDiff();
+    };
+    Watchdog watchdog; // rules from --watch or the 'watch' command, checked on every live refresh
+    ProcessColumns watchColumns; // one row per process, for the watchdog while threads are shown
+    auto checkWatchdog = [&]()
+    {
+        if (watchdog.empty() || replay)
+            return;
+        // thread rows hold tids and no owner or memory, and the actions
+        // signal whole processes: the rules always see process rows
+        const ProcessColumns *checked = &columns;
+        if (columns.threadRows)
+        {
+            watchColumns.build(processTable, true);
+            checked = &watchColumns;
+        }
+        watchdog.check(*checked, processTable, chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count());
+    };
+    // a live refresh, or the next snapshot of the capture
+    auto nextSnapshot = [&]() -> const SnapshotDiff &
+    {
+        if (!replay)
+        {
+            processTable.refresh();
+            columns.build(processTable);
+            checkWatchdog();
+            return processTable.getLastDiff();
+        }
+        if (replayPosition + 1 < replay->size())
+            replayPosition++;
+        rebuildColumns();
+        return replayDiff;
+    };
 
-    if (currentProcesses.empty())
+    if (historyDepth > 0 && !replay)
+        processTable.enableHistory(historyDepth, historyProcesses);
+    ViewSettings viewSettings; // active filters and sort order
+    if (!watchPath.empty())
+    {
+        string error;
+        if (replay || !watchdog.load(watchPath, error))
+        {
+            cout << "Cannot start the watchdog: " << (replay ? "it needs live processes" : error) << endl;
+            return 1;
+        }
+        viewSettings.watchColumns = watchdog.getColumns();
+        processTable.setColumns(viewSettings.neededColumns());
+        cout << "Watching " << watchdog.getRules().size() << " rules from " << watchPath << "." << endl;
+    }
+    if (!replay)
+        processTable.refresh();
+    rebuildColumns();
+    checkWatchdog();
+    ProcessView currentView = buildView(columns, viewSettings);
+
+    if (currentView.empty())
     {
         cout << "No processes found or error reading /proc." << endl;
         return 1;
@@ -321,425 +6698,1193 @@ int main()
 
     // display the list
     cout << "Displaying processes..." << endl;
-    displayProcesses(currentProcesses);
+    displayProcesses(currentView);
 
     cout << "Enter command (e.g., 'refresh', 'auto', 'exit'):" << endl;
     cout << " - 'refresh': Update process list once" << endl;
-    cout << " - 'auto [interval]': Auto-refresh every [interval] seconds (Ctrl+C to stop)" << endl;
-    cout << " - 'sort': Sort the process list by memory/priority/pid/ppid/name/cpu" << endl;
+    cout << " - 'auto [interval] [render interval]': Auto-refresh every [interval] seconds, e.g. 'auto 0.5' (Enter or Ctrl+C to stop)" << endl;
+    cout << " - 'sort [key] [a/d] [top]': Sort the process list by memory/priority/pid/ppid/name/cpu (or an optional column)" << endl;
     cout << " - 'exit': Quit the program" << endl;
-    cout << " - 'filter': Filter processes by memory/priority/name/owner/cpu" << endl;
-    cout << " - 'terminate': Terminate a process by PID" << endl;
-    cout << " - 'group': Group processes by owner or parent PID" << endl;
+    cout << " - 'filter [kind] [value]': Filter processes by memory/priority/name/owner/cpu/new/changed (or an optional column)" << endl;
+    cout << " - 'terminate [pid/filter/tree pid] [seconds]': Terminate one process, every filtered one or a subtree" << endl;
+    cout << " - 'group [owner/parent/cgroup]': Group processes by owner, parent PID or cgroup" << endl;
     cout << " - 'expand owner [name]': Expand to show processes owned by [name]" << endl;
     cout << " - 'expand pid [pid]': Expand to show children of PID [pid]" << endl;
+    cout << " - 'cpumode [core/total]': Show CPU% per core or of the whole machine" << endl;
+    cout << " - 'usercache [reload/ttl seconds]': Show or manage the uid -> user name cache" << endl;
+    cout << " - 'events [on/off]': Track processes with kernel fork/exit events, list short-lived ones" << endl;
+    cout << " - 'fdcache [on/off]': Keep /proc files open between refreshes" << endl;
+    cout << " - 'iouring [on/off]': Read /proc files in batches through io_uring" << endl;
+    cout << " - 'columns [list/default/all]': Choose the visible columns, e.g. 'columns pid,name,cpu' or 'columns +pss,wait'" << endl;
+    cout << " - 'tree [pid] [depth]': Show the process tree with CPU, RSS and thread totals per subtree" << endl;
+    cout << " - 'history [pid/top/depth/off]': Recent CPU, RSS and IO per process, fastest growing processes" << endl;
+    cout << " - 'watch [rules-file/off]': Check threshold rules (e.g. cpu > 90 for 30s then term,log) on every refresh" << endl;
+    cout << " - 'threads [all/pid.../off]': Show threads instead of whole processes, with per-thread CPU and state" << endl;
+    cout << " - 'stats [on/off]': Where the time of the last refresh went; on/off toggles a status line" << endl;
+    if (replay)
+        cout << " - 'seek [+/-seconds/#snapshot/unix ms/start/end]': Jump to another snapshot of the capture" << endl;
     cout << " - 'help': Show this help message" << endl;
     cout << "-------------------------------------" << endl;
     cout << "Type 'help' for available commands." << endl;
     cout << "-------------------------------------" << endl;
 
+    // auto mode: the loop's timer asks the background sampler for a refresh
+    // (replays step on the main thread), and a frame is drawn after every
+    // sample or, with a render interval, on a timer of its own. the main
+    // thread holds tableMutex except while it waits for the next event.
+    double autoInterval = 0;   // seconds between samples, 0 when auto mode is off
+    double renderInterval = 0; // seconds between frames, 0 for a frame per sample
+    bool autoPaused = false;   // a command typed during auto mode is on screen, frames wait
+    FrameRenderer renderer;
+    vector<string> frame;
+    mutex tableMutex;
+    unique_ptr<BackgroundSampler> sampler;
+    unique_lock<mutex> tableLock(tableMutex);
+
+    auto drawFrame = [&]()
+    {
+        ostringstream title;
+        if (replay)
+            title << "--- Replaying snapshot " << replayPosition + 1 << "/" << replay->size() << " at "
+                  << formatTimestamp(replay->timestamp(replayPosition));
+        else
+            title << "--- Auto-refreshing (every " << autoInterval << "s)";
+        title << " - Enter a command, or Enter / Ctrl+C to stop ---";
+        frame.clear();
+        frame.push_back(title.str());
+
+        // title, header, 2 separators, footer, "... more", the status line and the input row
+        size_t rowsAvailable = max(1, FrameRenderer::terminalRows() - (refreshStats.statusLine ? 8 : 7));
+        PhaseTimer timer(Phase::Render);
+        formatProcesses(currentView, lastDiff(), frame, rowsAvailable);
+        if (refreshStats.statusLine)
+            frame.push_back(COLOR_VALUE + refreshStats.summary() + COLOR_RESET); // render time of the previous frame
+        renderer.draw(frame);
+    };
+    auto stopAuto = [&]()
+    {
+        autoInterval = 0;
+        loop.setTimers(0, 0);
+        loop.setKeyMode(false);
+        tableLock.unlock(); // a refresh in progress has to finish before the sampler can stop
+        sampler.reset();
+        tableLock.lock();
+        renderer.reset();
+        if (!autoPaused)
+            cout << endl;
+        autoPaused = false;
+        cout << "Auto-refresh stopped." << endl;
+    };
+
     string command;
+    bool showPrompt = true;
     while (true)
     {
-        cout << "LPM> ";
-        if (!getline(cin, command))
-        { // Handle potential input errors or EOF
-            break;
+        bool drawing = autoInterval > 0 && !autoPaused;
+        if (showPrompt && !drawing)
+            cout << "LPM> " << flush;
+        showPrompt = false;
+
+        tableLock.unlock();
+        EventLoop::Event event = loop.wait(command);
+        tableLock.lock();
+
+        if (event == EventLoop::Event::Eof)
+        {
+            if (autoInterval == 0)
+                break; // with auto mode on, it keeps going until Ctrl+C
+            continue;
+        }
+        if (event == EventLoop::Event::Interrupt)
+        {
+            if (autoInterval > 0)
+                stopAuto();
+            else
+                cout << endl; // like a shell: drop the line, new prompt
+            if (loop.inputClosed())
+                break;
+            showPrompt = true;
+            continue;
+        }
+        if (event == EventLoop::Event::SampleTick)
+        {
+            if (autoInterval == 0)
+                continue; // was already queued when auto mode stopped
+            if (!replay)
+            {
+                sampler->request();
+                continue;
+            }
+            nextSnapshot();
+            currentView = buildView(columns, viewSettings);
+            if (drawing && renderInterval == 0)
+                drawFrame();
+            if (replayPosition + 1 == replay->size())
+            {
+                stopAuto(); // show the last one and stop
+                showPrompt = true;
+            }
+            continue;
+        }
+        if (event == EventLoop::Event::Sampled)
+        {
+            if (autoInterval == 0)
+                continue;
+            columns.build(processTable);
+            checkWatchdog();
+            currentView = buildView(columns, viewSettings);
+            if (drawing && (renderInterval == 0 || !renderer.hasFrame())) // the first frame doesn't wait for the render timer
+                drawFrame();
+            continue;
+        }
+        if (event == EventLoop::Event::RenderTick || event == EventLoop::Event::Resize)
+        {
+            if (drawing)
+                drawFrame();
+            continue;
+        }
+        if (event == EventLoop::Event::Input)
+        {
+            if (drawing)
+                renderer.drawInput("LPM> " + loop.getInput());
+            continue;
+        }
+
+        showPrompt = true;
+        if (autoInterval > 0)
+        {
+            // Enter alone stops auto mode, or resumes it after a command.
+            // a command runs right away, and its output stays on screen
+            // until Enter; sampling (and the watchdog) carry on meanwhile.
+            if (command == "stop" || (command.empty() && !autoPaused))
+            {
+                stopAuto();
+                if (loop.inputClosed())
+                    break;
+                continue;
+            }
+            if (command.empty())
+            {
+                autoPaused = false;
+                loop.setKeyMode(true);
+                renderer.reset();
+                drawFrame();
+                continue;
+            }
+            if (!autoPaused)
+            {
+                autoPaused = true;
+                loop.setKeyMode(false);
+                renderer.reset();
+                cout << endl
+                     << "LPM> " << command << endl;
+            }
         }
         if (command == "exit")
         {
             break;
         }
-        else if (command == "refresh")
+        else if (replay && (command.substr(0, 9) == "terminate" || command.substr(0, 10) == "expand pid" || command.substr(0, 4) == "tree" ||
+                            command.substr(0, 7) == "history" || command.substr(0, 6) == "events" || command.substr(0, 7) == "fdcache" ||
+                            command.substr(0, 7) == "iouring" ||
+                            command.substr(0, 7) == "threads" || command.substr(0, 5) == "watch"))
         {
-            cout << "Refreshing process list..." << endl;
-            currentProcesses = findProcesses(); // Get updated list
-            displayProcesses(currentProcesses); // Display updated list
+            cout << "'" << command << "' needs live processes and is not available while replaying." << endl;
         }
-        else if (command.substr(0, 4) == "auto")
+        else if (command == "seek" || command.substr(0, 5) == "seek ")
         {
-            int interval = 2; // Default interval in seconds
-
-            if (command.length() > 5)
+            // "seek +10" / "seek -10" seconds, "seek #5" by snapshot number,
+            // "seek 1700000000000" by unix time in ms, "seek start" / "seek end"
+            if (!replay)
             {
-                try
-                {
-                    interval = stoi(command.substr(5));
-                    if (interval < 1)
-                        interval = 1; // Minimum 1 second
-                }
-                catch (...)
+                cout << "'seek' only works while replaying a capture (--replay file)." << endl;
+                continue;
+            }
+            string target = command.length() > 5 ? command.substr(5) : "";
+            try
+            {
+                if (target == "start")
+                    replayPosition = 0;
+                else if (target == "end")
+                    replayPosition = replay->size() - 1;
+                else if (!target.empty() && target[0] == '#')
+                    replayPosition = min(replay->size(), max(1ul, stoul(target.substr(1)))) - 1;
+                else if (!target.empty() && (target[0] == '+' || target[0] == '-'))
                 {
-                    cout << "Invalid interval. Using default 2 seconds." << endl;
+                    long long deltaMs = (long long)(stod(target) * 1000);
+                    long long current = replay->timestamp(replayPosition);
+                    replayPosition = replay->seek((uint64_t)max(0LL, current + deltaMs));
                 }
+                else if (!target.empty())
+                    replayPosition = replay->seek(stoull(target));
             }
-
-            cout << "Auto-refreshing every " << interval << " seconds. Press Ctrl+C to stop." << endl;
-            running = true;
-
-            while (running)
+            catch (...)
             {
-                clearScreen();
-                cout << "--- Auto-refreshing (every " << interval << "s) - Press Ctrl+C to stop ---" << endl;
-                currentProcesses = findProcesses();
-                displayProcesses(currentProcesses);
-
-                // Sleep for the specified interval
-                this_thread::sleep_for(chrono::seconds(interval));
+                cout << "Invalid seek target. Use +/-seconds, #snapshot, a unix time in ms, 'start' or 'end'." << endl;
+                continue;
+            }
+            if (!target.empty())
+            {
+                rebuildColumns();
+                currentView = buildView(columns, viewSettings);
+                displayProcesses(currentView, lastDiff());
             }
+            cout << "Snapshot " << replayPosition + 1 << "/" << replay->size() << " at " << formatTimestamp(replay->timestamp(replayPosition)) << endl;
+        }
+        else if (command == "refresh")
+        {
+            cout << "Refreshing process list..." << endl;
+            if (replay && replayPosition + 1 == replay->size())
+                cout << "Already at the last snapshot." << endl;
+            const SnapshotDiff &diff = nextSnapshot(); // update the table in place
+            currentView = buildView(columns, viewSettings);
+            displayProcesses(currentView, &diff); // Display updated list
+            if (replay)
+                cout << "Snapshot " << replayPosition + 1 << "/" << replay->size() << " at " << formatTimestamp(replay->timestamp(replayPosition)) << endl;
+        }
+        else if (command == "auto" || command.substr(0, 5) == "auto ")
+        {
+            // "auto [seconds] [render seconds]": sample every [seconds] (default 2,
+            // fractions allowed) and draw after every sample, or every [render seconds]
+            double interval = 2, render = 0;
+            string first, second;
+            stringstream args(command.substr(4));
+            args >> first >> second;
+            try
+            {
+                if (!first.empty())
+                    interval = stod(first);
+                if (!second.empty())
+                    render = stod(second);
+            }
+            catch (...)
+            {
+                cout << "Invalid interval. Use 'auto [seconds] [render seconds]', e.g. 'auto 0.5' or 'auto 0.2 1'." << endl;
+                continue;
+            }
+            interval = max(0.1, interval);
+            render = render > 0 ? max(0.05, render) : 0;
 
-            cout << "Auto-refresh stopped." << endl;
+            autoInterval = interval;
+            renderInterval = render == interval ? 0 : render;
+            autoPaused = false;
+            if (!replay && !sampler)
+                sampler.reset(new BackgroundSampler(processTable, tableMutex, loop));
+            cout << "Auto-refreshing every " << autoInterval << "s";
+            if (renderInterval > 0)
+                cout << ", drawing every " << renderInterval << "s";
+            cout << ". Type a command to run it, Enter or Ctrl+C stops." << endl;
+            loop.setTimers(autoInterval, renderInterval);
+            loop.setKeyMode(true);
+            renderer.reset();
+            if (!replay)
+            {
+                sampler->request(); // the first frame comes with the first sample
+                continue;
+            }
+            nextSnapshot();
+            currentView = buildView(columns, viewSettings);
+            drawFrame();
+            if (replayPosition + 1 == replay->size())
+                stopAuto();
         }
         else if (command == "help")
         {
             cout << "Available commands:\n";
             cout << "  refresh - Reload and display the process list.\n";
-            cout << "  auto [seconds] - Automatically refresh the process list every [seconds] seconds.\n";
-            cout << "  sort    - Sort the process list by memory/priority/pid/ppid/name/cpu.\n";
+            cout << "  auto [seconds] [render seconds] - Refresh the process list every [seconds] seconds (fractions\n";
+            cout << "                   allowed) on a background thread, drawing after each refresh or every [render\n";
+            cout << "                   seconds]. Commands typed meanwhile run right away; Enter or Ctrl+C stops.\n";
+            cout << "  sort [key] [a/d] [top] - Sort the process list by memory/priority/pid/ppid/name/cpu, e.g. 'sort cpu d 50' for the top 50.\n";
             cout << "  exit    - Quit the program.\n";
-            cout << "  filter  - Filter processes by memory/priority/name/owner.\n";
-            cout << "  terminate - Terminate a process by PID.\n";
-            cout << "  group   - Group processes by owner or parent PID.\n";
+            cout << "  filter [kind] [value] - Filter processes by memory/priority/name/owner/cpu, or new/changed since the last refresh.\n";
+            cout << "                          Filters add up ('filter cpu 5' then 'filter owner root'); 'filter list' / 'filter clear'.\n";
+            cout << "  terminate [pid] [seconds] - Terminate a process: SIGTERM, then SIGKILL if it is still running\n";
+            cout << "                   after [seconds] (default 5).\n";
+            cout << "  terminate filter [seconds] - Terminate every process of the current filtered view.\n";
+            cout << "  terminate tree [pid] [seconds] - Terminate a process and all its descendants. Targets are\n";
+            cout << "                   pinned with pidfds first, so a PID reused since the last refresh is never hit.\n";
+            cout << "  group [owner/parent/cgroup] - Group processes by owner, parent PID or cgroup v2 (systemd\n";
+            cout << "                   service, container), with the cgroup's own CPU, memory and IO.\n";
+            cout << "  expand cgroup [path] - Show the processes of one cgroup.\n";
             cout << "  expand owner [name] - Expand to show processes owned by [name].\n";
             cout << "  expand pid [pid] - Expand to show children of PID [pid].\n";
+            cout << "  cpumode [core/total] - CPU% over the last refresh, per core (100% = one busy core) or of all " << processTable.getCpuCount() << " cpus.\n";
+            cout << "  usercache [reload/ttl seconds] - Show cache stats, refill it from /etc/passwd or expire entries after [seconds] (0 = never).\n";
+            cout << "  events [on/off] - Use the kernel proc connector instead of walking /proc each refresh, and show\n";
+            cout << "                    processes that started and exited between refreshes.\n";
+            cout << "  fdcache [on/off] - Keep each pid's /proc stat/status open and re-read them with pread().\n";
+            cout << "  iouring [on/off] - Submit the stat/status opens and reads of each batch of pids through io_uring\n";
+            cout << "                     and parse them as they complete. Falls back to plain reads without io_uring.\n";
+            cout << "  columns [list/default/all] - Show only some columns (e.g. 'columns pid,name,cpu'), or add/remove\n";
+            cout << "                       some with 'columns +pss,swap' / 'columns -owner'. Optional columns: ioread/iowrite\n";
+            cout << "                       (KB/s), pss/swap (MB, from smaps_rollup), vcsw/ivcsw (context switches/s) and\n";
+            cout << "                       wait (run queue wait, ms/s). They sort and filter like the others. /proc files behind\n";
+            cout << "                       hidden columns are only read when a sort key or filter needs them.\n";
+            cout << "  tree [pid] [depth] - Show the process tree (below [pid]) with the total CPU, RSS and threads\n";
+            cout << "                       of each subtree.\n";
+            cout << "  history - Show how much history is kept.\n";
+            cout << "  history pid [pid] [seconds] - Sparklines and min/max/avg of CPU, RSS and IO for one process.\n";
+            cout << "  history top [cpu/rss/io] [seconds] [count] - Processes whose CPU or RSS grew fastest, or the\n";
+            cout << "                       highest IO throughput, over the last [seconds] (default: all kept).\n";
+            cout << "  history depth [refreshes] [processes] - Resize (and clear) the history. 'history off' stops it.\n";
+            cout << "  watch [rules-file/off] - Check watchdog rules on every refresh, one per line of the file:\n";
+            cout << "                   [name:] cpu > 90 and owner == app [for 30s] [clear 10s] then term,log [limit 5 per 60s]\n";
+            cout << "                   Columns: cpu/memory/priority/pid/ppid/name/owner/state and the optional ones;\n";
+            cout << "                   actions: log, term, kill, stop. A line 'log [file]' appends the log to a file.\n";
+            cout << "                   'watch' alone shows how often each rule fired.\n";
+            cout << "  threads [all/pid.../off] - List every process, or only the given ones, per thread from\n";
+            cout << "                   /proc/<pid>/task: PID/TID holds the thread id, PPID the process of the thread.\n";
+            cout << "  stats [on/off] - Time per phase of the last refresh (enumerate, read, parse, users, merge,\n";
+            cout << "                   history, sort/filter, render), files opened, bytes read and heap allocations.\n";
+            cout << "                   'stats on' prints a one-line summary under every table.\n";
+            cout << "  seek [target] - While replaying (--replay file): jump by +/-seconds, to #snapshot, to a unix\n";
+            cout << "                  time in ms, or to the start/end of the capture. refresh/auto step forward.\n";
             cout << "  help    - Show this help message.\n";
             cout << "-------------------------------------" << endl;
             cout << "Type 'help' for available commands." << endl;
             cout << "-------------------------------------" << endl;
         }
-        else if (command == "sort")
+        else if (command == "sort" || command.substr(0, 5) == "sort ")
         {
+            // "sort [key] [a/d] [top]", anything missing is asked for
             string sortBy;
-            char ascOrDesc;
-            string sortedBy;
-            cout << "Sort by: (memory/priority/pid/ppid/name/cpu) " << endl;
-            cin >> sortBy;
-            cout << "Ascending or Descending? (a/d)" << endl;
-            cin >> ascOrDesc;
+            char ascOrDesc = 0;
+            size_t limit = 0;
+            stringstream args(command.substr(4));
+            args >> sortBy >> ascOrDesc >> limit;
+            if (sortBy.empty())
+            {
+                cout << "Sort by: (memory/priority/pid/ppid/name/cpu/ioread/iowrite/pss/swap/vcsw/ivcsw/wait) " << endl;
+                loop.prompt(sortBy);
+            }
+            const SortOption *option = findSortOption(sortBy);
+            if (!option)
+            {
+                cout << "Invalid sort option. Please try again." << endl;
+                continue;
+            }
+            if (ascOrDesc == 0)
+            {
+                cout << "Ascending or Descending? (a/d)" << endl;
+                loop.prompt(ascOrDesc);
+            }
+            if (ascOrDesc != 'a' && ascOrDesc != 'd')
+            {
+                cout << "Invalid order. Use 'a' or 'd'." << endl;
+                continue;
+            }
 
-            if (sortBy == "memory")
+            string order = ascOrDesc == 'a' ? "ascending" : "descending";
+            viewSettings.sortBy = option;
+            viewSettings.descending = ascOrDesc == 'd';
+            viewSettings.limit = limit > 0 ? limit : SIZE_MAX;
+            cout << "Sorting processes by " << option->label << " in " << order << " order..." << endl;
+            processTable.setColumns(viewSettings.neededColumns()); // e.g. read memory even while it is hidden
+            rebuildColumns();
+            currentView = buildView(columns, viewSettings);
+            displayProcesses(currentView, lastDiff());
+            if (limit > 0)
+                cout << "Displayed the top " << currentView.size() << " processes in " << order << " order of " << option->label << "." << endl;
+            else
+                cout << "Displayed processes in " << order << " order of " << option->label << "." << endl;
+        }
+        else if (command == "filter" || command.substr(0, 7) == "filter ")
+        {
+            // "filter [kind] [value]", "filter list" or "filter clear"
+            string filterBy, value;
+            stringstream args(command.substr(6));
+            args >> filterBy >> value;
+            if (filterBy == "clear")
             {
-                if (ascOrDesc == 'a')
-                {
-                    cout << "Sorting processes by memory usage in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getMemoryUsage() < b->getMemoryUsage(); });
-                    sortedBy = "Displayed processes in ascending order of memory usage.";
-                }
-                else if (ascOrDesc == 'd')
-                {
-                    cout << "Sorting processes by memory usage in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getMemoryUsage() > b->getMemoryUsage(); });
-                    sortedBy = "Displayed processes in descending order of memory usage.";
-                }
+                viewSettings.filters.clear();
+                processTable.setColumns(viewSettings.neededColumns());
+                currentView = buildView(columns, viewSettings);
+                cout << "Filters cleared." << endl;
+                continue;
             }
-            else if (sortBy == "priority")
+            if (filterBy == "list")
             {
-                if (ascOrDesc == 'a')
-                {
-                    cout << "Sorting processes by priority in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getPriority() < b->getPriority(); });
-                    sortedBy = "Displayed processes in ascending order of priority.";
-                }
-                else if (ascOrDesc == 'd')
+                cout << "Active filters: " << viewSettings.describeFilters() << endl;
+                continue;
+            }
+            if (filterBy.empty())
+            {
+                cout << "Filter by: (memory/priority/name/owner/cpu/new/changed) " << endl;
+                loop.prompt(filterBy);
+            }
+            if (value.empty() && filterBy != "new" && filterBy != "changed")
+            {
+                if (filterBy == "memory")
+                    cout << "Enter memory usage threshold (%) as a decimal (e.g., 0.5 for 0.5%): ";
+                else if (filterBy == "priority")
+                    cout << "Enter priority threshold: ";
+                else if (filterBy == "name")
+                    cout << "Enter name filter: ";
+                else if (filterBy == "owner")
+                    cout << "Enter owner filter: ";
+                else if (filterBy == "cpu")
+                    cout << "Enter CPU usage threshold (%) as a decimal (e.g., 0.5 for 0.5%): ";
+                else if (findSortOption(filterBy) && (findSortOption(filterBy)->column & ColumnsExtra))
+                    cout << "Enter threshold (KB/s for ioread/iowrite, MB for pss/swap, per second for vcsw/ivcsw, ms/s for wait): ";
+                else
                 {
-                    cout << "Sorting processes by priority in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getPriority() > b->getPriority(); });
-                    sortedBy = "Displayed processes in descending order of priority.";
+                    cout << "Invalid filter option. Please try again." << endl;
+                    continue;
                 }
+                loop.prompt(value);
+            }
+
+            RowFilter filter;
+            string error;
+            if (!makeFilter(filterBy, value, filter, error))
+            {
+                cout << error << endl;
+                continue;
             }
-            else if (sortBy == "pid")
+            viewSettings.filters.push_back(std::move(filter)); // filters add up until 'filter clear'
+            processTable.setColumns(viewSettings.neededColumns());
+            rebuildColumns();
+            currentView = buildView(columns, viewSettings);
+            displayProcesses(currentView, lastDiff());
+            cout << "Filtered processes displayed. Active filters: " << viewSettings.describeFilters()
+                 << " ('filter clear' to reset)" << endl;
+        }
+        else if (command == "terminate" || command.substr(0, 10) == "terminate ")
+        {
+            // "terminate [pid] [seconds]", "terminate filter [seconds]" for every row of the current
+            // (filtered) view, "terminate tree [pid] [seconds]" for a process and all its descendants.
+            // SIGTERM first, SIGKILL for whatever is still running after [seconds] (default 5)
+            stringstream args(command.substr(9));
+            string mode, arg1, arg2;
+            args >> mode >> arg1 >> arg2;
+            string timeoutArg = mode == "filter" ? arg1 : mode == "tree" ? arg2 : arg1;
+            double timeout = 5;
+            if (!timeoutArg.empty())
             {
-                if (ascOrDesc == 'a')
+                char *end;
+                timeout = strtod(timeoutArg.c_str(), &end);
+                if (*end || timeout < 0)
                 {
-                    cout << "Sorting processes by PID in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getPID() < b->getPID(); });
-                    sortedBy = "Displayed processes in ascending order of PID.";
+                    cout << "Invalid timeout. Use a number of seconds." << endl;
+                    continue;
                 }
-                else if (ascOrDesc == 'd')
+            }
+
+            SignalBatch batch;
+            auto addProcess = [&](int pid)
+            {
+                if (const Process *proc = processTable.find(pid))
+                    batch.add(pid, proc->getStartTime(), proc->getName());
+            };
+            if (mode == "filter")
+            {
+                if (viewSettings.filters.empty())
                 {
-                    cout << "Sorting processes by PID in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getPID() > b->getPID(); });
-                    sortedBy = "Displayed processes in descending order of PID.";
+                    cout << "No filter is active. Use 'filter [kind] [value]' to pick the processes first." << endl;
+                    continue;
                 }
+                for (uint32_t row : currentView.rows)
+                    addProcess(columns.pid[row]); // thread rows other than the main thread are not processes and are skipped
             }
-            else if (sortBy == "ppid")
+            else if (mode == "tree")
             {
-                if (ascOrDesc == 'a')
+                int root = 0;
+                ProcessTree &tree = processTable.getTree();
+                if (!parseNumeric(arg1, root) || !tree.contains(root))
                 {
-                    cout << "Sorting processes by PPID in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getParentPID() < b->getParentPID(); });
-                    sortedBy = "Displayed processes in ascending order of PPID.";
+                    cout << "Usage: terminate tree [pid] [seconds], for a PID in the last refresh." << endl;
+                    continue;
                 }
-                else if (ascOrDesc == 'd')
+                vector<int> stack{root};
+                while (!stack.empty())
                 {
-                    cout << "Sorting processes by PPID in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getParentPID() > b->getParentPID(); });
-                    sortedBy = "Displayed processes in descending order of PPID.";
+                    int pid = stack.back();
+                    stack.pop_back();
+                    addProcess(pid);
+                    for (int child : tree.children(pid))
+                        if (child != pid)
+                            stack.push_back(child);
                 }
             }
-            else if (sortBy == "name")
+            else
             {
-                if (ascOrDesc == 'a')
+                int pidToTerminate = 0;
+                if (mode.empty())
                 {
-                    cout << "Sorting processes by name in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getName() < b->getName(); });
-                    sortedBy = "Displayed processes in ascending order of name.";
+                    cout << "Enter PID to terminate: ";
+                    loop.prompt(pidToTerminate);
                 }
-                else if (ascOrDesc == 'd')
+                else if (!parseNumeric(mode, pidToTerminate))
                 {
-                    cout << "Sorting processes by name in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getName() > b->getName(); });
-                    sortedBy = "Displayed processes in descending order of name.";
+                    cout << "Usage: terminate [pid] [seconds] | terminate filter [seconds] | terminate tree [pid] [seconds]" << endl;
+                    continue;
                 }
+                const Process *proc = processTable.find(pidToTerminate);
+                unsigned long long startTime = proc ? proc->getStartTime() : SignalBatch::currentStartTime(pidToTerminate);
+                batch.add(pidToTerminate, startTime, proc ? proc->getName() : "?");
             }
-            else if (sortBy == "cpu")
+
+            if (batch.size() == 0)
             {
-                if (ascOrDesc == 'a')
-                {
-                    cout << "Sorting processes by CPU usage in ascending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getCPUUsage() < b->getCPUUsage(); });
-                    sortedBy = "Displayed processes in ascending order of CPU usage.";
-                }
-                else if (ascOrDesc == 'd')
+                cout << "No processes selected." << endl;
+                continue;
+            }
+            if (mode == "filter" || mode == "tree")
+            {
+                cout << "Send SIGTERM to " << batch.size() << " processes, and SIGKILL to any still running after "
+                     << timeout << "s? (y/n): ";
+                char choice = 0;
+                loop.prompt(choice);
+                if (choice != 'y' && choice != 'Y')
                 {
-                    cout << "Sorting processes by CPU usage in descending order..." << endl;
-                    sort(currentProcesses.begin(), currentProcesses.end(), [](const unique_ptr<Process> &a, const unique_ptr<Process> &b)
-                         { return a->getCPUUsage() > b->getCPUUsage(); });
-                    sortedBy = "Displayed processes in descending order of CPU usage.";
+                    cout << "Nothing was sent." << endl;
+                    continue;
                 }
             }
-            else
+
+            // the targets are pinned by pidfd, so the table isn't needed while
+            // waiting for them: let the background sampler keep going
+            string error;
+            tableLock.unlock();
+            bool sent = batch.run(SIGTERM, timeout, error);
+            tableLock.lock();
+            if (!sent)
             {
-                cout << "Invalid sort option. Please try again." << endl;
+                cout << "Cannot terminate: " << error << endl;
+                continue;
+            }
+            map<SignalBatch::Outcome, size_t> counts;
+            cout << fixed << setprecision(2);
+            for (const SignalBatch::Target &target : batch.getTargets())
+            {
+                counts[target.outcome]++;
+                cout << "  PID " << left << setw(8) << target.pid << setw(25) << target.name.substr(0, 24)
+                     << SignalBatch::describe(target.outcome) << right;
+                if (target.outcome == SignalBatch::Outcome::Exited || target.outcome == SignalBatch::Outcome::Killed)
+                    cout << " after " << target.seconds << "s";
+                if (target.outcome == SignalBatch::Outcome::Failed)
+                    cout << ": " << strerror(target.error);
+                cout << endl;
             }
-            displayProcesses(currentProcesses);
-            cout << sortedBy << endl;
+            string summary;
+            for (const auto &[outcome, count] : counts)
+                summary += (summary.empty() ? "" : ", ") + to_string(count) + " " + SignalBatch::describe(outcome);
+            cout << batch.size() << " processes: " << summary << "." << endl;
         }
-        else if (command == "filter")
+        else if (command == "group" || command.substr(0, 6) == "group ")
         {
-            vector<Process *> filteredProcesses;
-            string filterBy;
-            cout << "Filter by: (memory/priority/name/owner/cpu) " << endl;
-            cin >> filterBy;
-
-            if (filterBy == "memory")
+            string groupType = command.length() > 6 ? command.substr(6) : "";
+            if (groupType.empty())
             {
-                double threshold;
-                cout << "Enter memory usage threshold (%) as a decimal (e.g., 0.5 for 0.5%): ";
-                cin >> threshold;
+                cout << "Group by (owner/parent/cgroup): ";
+                loop.prompt(groupType);
+            }
 
-                // Create a vector of raw pointers for filtered view
-                for (const auto &proc : currentProcesses)
+            if (groupType == "owner")
+            {
+                processTable.loadColumns(ColumnOwner); // just for this snapshot if the owner is hidden
+                rebuildColumns();
+                currentView = buildView(columns, viewSettings);
+                unordered_map<uint32_t, size_t> countsById; // count by interned owner id first
+                for (uint32_t row : currentView.rows)
                 {
-                    if (proc->getMemoryUsage() > threshold)
-                    {
-                        filteredProcesses.push_back(proc.get());
-                    }
+                    countsById[columns.ownerId[row]]++;
+                }
+                map<string, size_t> ownerGroups; // then order by name for display
+                for (const auto &[ownerId, count] : countsById)
+                {
+                    ownerGroups[userCache.name(ownerId)] += count;
                 }
-            }
-            else if (filterBy == "priority")
-            {
-                int threshold;
-                cout << "Enter priority threshold: ";
-                cin >> threshold;
 
-                // Create a vector of raw pointers for filtered view
-                for (const auto &proc : currentProcesses)
+                cout << "Grouped by owner:\n\n";
+                for (const auto &[owner, count] : ownerGroups)
                 {
-                    if (proc->getPriority() > threshold)
-                    {
-                        filteredProcesses.push_back(proc.get());
-                    }
+                    cout << "[+] " << owner << " (" << count << " processes)" << endl;
                 }
+                cout << "\nType 'expand owner [name]' to view details.\n";
             }
-            else if (filterBy == "name")
+            else if (groupType == "parent")
             {
-                string nameFilter;
-                cout << "Enter name filter: ";
-                cin >> nameFilter;
+                map<int, size_t> parentMap;
+                for (uint32_t row : currentView.rows)
+                {
+                    parentMap[columns.ppid[row]]++;
+                }
 
-                // Create a vector of raw pointers for filtered view
-                for (const auto &proc : currentProcesses)
+                cout << "Grouped by parent PID:\n\n";
+                for (const auto &[ppid, count] : parentMap)
                 {
-                    if (proc->getName().find(nameFilter) != string::npos)
-                    {
-                        filteredProcesses.push_back(proc.get());
-                    }
+                    cout << "[+] PID " << ppid << " (" << count << " children)" << endl;
                 }
+                cout << "\nType 'expand pid [pid]' to view children.\n";
             }
-            else if (filterBy == "owner")
+            else if (groupType == "cgroup")
             {
-                string ownerFilter;
-                cout << "Enter owner filter: ";
-                cin >> ownerFilter;
+                if (replay)
+                {
+                    cout << "Grouping by cgroup needs live processes and is not available while replaying." << endl;
+                    continue;
+                }
+                processTable.enableCgroups(); // from now on every refresh keeps them up to date
+                struct CgroupGroup
+                {
+                    size_t processes = 0;
+                    double cpu = 0;    // summed over the rows
+                    double memory = 0; // same, % of RAM
+                };
+                unordered_map<uint32_t, CgroupGroup> groups;
+                for (uint32_t row : currentView.rows)
+                {
+                    const Process *proc = processTable.find(columns.pid[row]);
+                    if (!proc || proc->getCgroupId() == Process::NoCgroup)
+                        continue; // thread rows, or a process that exited since
+                    CgroupGroup &group = groups[proc->getCgroupId()];
+                    group.processes++;
+                    group.cpu += columns.cpu[row];
+                    group.memory += columns.memory[row];
+                }
 
-                // Create a vector of raw pointers for filtered view
-                for (const auto &proc : currentProcesses)
+                // the cgroup's own CPU% where there is one, the rows' sum otherwise
+                vector<pair<uint32_t, CgroupGroup>> ordered(groups.begin(), groups.end());
+                auto cpuOf = [&](const pair<uint32_t, CgroupGroup> &group)
                 {
-                    if (proc->getOwner().find(ownerFilter) != string::npos)
-                    {
-                        filteredProcesses.push_back(proc.get());
-                    }
+                    double cpu = processTable.getCgroupUsage(group.first).cpuPercent;
+                    return cpu >= 0 ? cpu : group.second.cpu;
+                };
+                sort(ordered.begin(), ordered.end(), [&](const auto &a, const auto &b)
+                     { return cpuOf(a) > cpuOf(b); });
+
+                cout << "Grouped by cgroup:\n\n";
+                char line[512];
+                snprintf(line, sizeof(line), "%-45s%-8s%-10s%-14s%-12s%-10s", "Cgroup", "Procs", "CPU(%)", "Procs CPU(%)", "Memory(MB)", "IO(KB/s)");
+                cout << COLOR_HEADER << line << COLOR_RESET << endl;
+                auto number = [](double value, double scale)
+                {
+                    char text[32];
+                    snprintf(text, sizeof(text), "%.1f", value / scale);
+                    return value < 0 ? string("-") : string(text);
+                };
+                for (const auto &[id, group] : ordered)
+                {
+                    const CgroupUsage &usage = processTable.getCgroupUsage(id);
+                    string path = processTable.cgroupPath(id);
+                    if (path.size() > 44)
+                        path = "..." + path.substr(path.size() - 41); // the service is at the end
+                    snprintf(line, sizeof(line), "%-45s%-8zu%-10s%-14.1f%-12s%-10s", path.c_str(), group.processes,
+                             number(usage.cpuPercent, 1).c_str(), group.cpu, number(usage.memoryBytes, 1024 * 1024).c_str(),
+                             number(usage.ioRate, 1024).c_str());
+                    cout << line << endl;
                 }
+                cout << "\nCPU, memory and IO are the cgroup's own (cpu.stat, memory.current, io.stat; '-' where the\n"
+                        "controller is off or until the next refresh), Procs CPU sums the listed processes.\n"
+                        "Type 'expand cgroup [path]' to view its processes.\n";
+            }
+            else
+            {
+                cout << "Invalid group type. Use 'owner', 'parent' or 'cgroup'." << endl;
             }
-            else if (filterBy == "cpu")
+        }
+        else if (command.substr(0, 13) == "expand owner ")
+        {
+            string ownerName = command.substr(13);
+            processTable.loadColumns(ColumnOwner);
+            rebuildColumns();
+            currentView = buildView(columns, viewSettings);
+            vector<uint32_t> ownedRows;
+            for (uint32_t row : currentView.rows)
             {
-                double threshold;
-                cout << "Enter CPU usage threshold (%) as a decimal (e.g., 0.5 for 0.5%): ";
-                cin >> threshold;
+                if (columns.owner(row) == ownerName)
+                    ownedRows.push_back(row);
+            }
 
-                // Create a vector of raw pointers for filtered view
-                for (const auto &proc : currentProcesses)
+            if (!ownedRows.empty())
+            {
+                cout << "\nProcesses owned by: " << ownerName << "\n";
+                for (uint32_t row : ownedRows)
                 {
-                    if (proc->getCPUUsage() > threshold)
-                    {
-                        filteredProcesses.push_back(proc.get());
-                    }
+                    cout << "  PID " << columns.pid[row] << " | Name: " << columns.name(row)
+                         << " | PPID: " << columns.ppid[row] << endl;
                 }
             }
             else
             {
-                cout << "Invalid filter option. Please try again." << endl;
+                cout << "Owner group not found." << endl;
+            }
+        }
+        else if (command.substr(0, 14) == "expand cgroup ")
+        {
+            string path = command.substr(14);
+            if (replay)
+            {
+                cout << "'" << command << "' needs live processes and is not available while replaying." << endl;
                 continue;
             }
-            vector<unique_ptr<Process>> tempProcesses;
-            for (Process *proc : filteredProcesses)
+            processTable.enableCgroups();
+            size_t found = 0;
+            for (uint32_t row : currentView.rows)
             {
-                tempProcesses.push_back(unique_ptr<Process>(new Process(*proc)));
+                const Process *proc = processTable.find(columns.pid[row]);
+                if (!proc || proc->getCgroupId() == Process::NoCgroup || processTable.cgroupPath(proc->getCgroupId()) != path)
+                    continue;
+                if (found++ == 0)
+                    cout << "\nProcesses in cgroup: " << path << "\n";
+                cout << "  PID " << columns.pid[row] << " | Name: " << columns.name(row)
+                     << " | CPU: " << fixed << setprecision(1) << columns.cpu[row] << "%" << endl;
             }
-            displayProcesses(tempProcesses);
-            cout << "Filtered processes displayed." << endl;
+            if (!found)
+                cout << "Cgroup not found. 'group cgroup' lists them." << endl;
         }
-        else if (command == "terminate")
+        else if (command.substr(0, 11) == "expand pid ")
         {
-            int pidToTerminate;
-            cout << "Enter PID to terminate: ";
-            cin >> pidToTerminate;
+            int parentPid = stoi(command.substr(11));
+            processTable.loadColumns(ColumnOwner | ColumnMemory);
+            ProcessTree &tree = processTable.getTree();
+            vector<int> childPids = tree.children(parentPid);
+            sort(childPids.begin(), childPids.end());
 
-            if (kill(pidToTerminate, SIGTERM) == 0) // if the termination was successful
-            {
-                cout << "Process " << pidToTerminate << " terminated with SIGTERM." << endl;
-            }
-            else
+            if (!childPids.empty())
             {
-                perror("SIGTERM failed");
-                cout << "Do you want to force kill the process using SIGKILL (kill -9)? (y/n): ";
-                char choice;
-                cin >> choice;
-                if (choice == 'y' || choice == 'Y')
+                cout << "\nChildren of PID " << parentPid << ":\n";
+                for (int childPid : childPids)
                 {
-                    if (kill(pidToTerminate, SIGKILL) == 0)
-                    {
-                        cout << "Process " << pidToTerminate << " forcefully terminated with SIGKILL." << endl;
-                    }
-                    else
-                    {
-                        perror("SIGKILL also failed");
-                    }
+                    const Process *child = processTable.find(childPid);
+                    const ProcessTree::Totals &totals = tree.totals(childPid);
+                    cout << "  PID " << childPid << " | Name: " << child->getName()
+                         << " | Owner: " << child->getOwner()
+                         << " | Subtree: " << totals.processes << " processes, " << fixed << setprecision(1)
+                         << totals.cpu << "% CPU, " << totals.rssKB / 1024.0 << " MB" << endl;
                 }
-                else
+                if (tree.contains(parentPid))
                 {
-                    cout << "Process was not forcefully terminated." << endl;
+                    const ProcessTree::Totals &totals = tree.totals(parentPid);
+                    cout << "Whole tree of " << parentPid << ": " << totals.processes << " processes, "
+                         << totals.cpu << "% CPU, " << totals.rssKB / 1024.0 << " MB RSS, "
+                         << totals.threads << " threads" << endl;
                 }
             }
+            else
+            {
+                cout << "No children found for PID " << parentPid << "." << endl;
+            }
+        }
+        else if (command == "tree" || command.substr(0, 5) == "tree ")
+        {
+            // "tree", "tree [pid]" or "tree [pid] [depth]"
+            int rootPid = 0;
+            size_t depth = SIZE_MAX;
+            stringstream args(command.substr(4));
+            string pidArg, depthArg;
+            args >> pidArg >> depthArg;
+            if ((!pidArg.empty() && !isNumeric(pidArg)) || (!depthArg.empty() && !isNumeric(depthArg)))
+            {
+                cout << "Usage: tree [pid] [depth]" << endl;
+                continue;
+            }
+            if (!pidArg.empty())
+                rootPid = stoi(pidArg);
+            if (!depthArg.empty())
+                depth = stoul(depthArg);
+            if (rootPid && !processTable.find(rootPid))
+            {
+                cout << "No process with PID " << rootPid << "." << endl;
+                continue;
+            }
+            processTable.loadColumns(ColumnMemory); // the tree sums RSS even if memory is hidden
+            displayTree(processTable, rootPid, depth);
         }
-        else if (command == "group")
+        else if (command.substr(0, 7) == "cpumode")
         {
-            cout << "Group by (owner/parent): ";
-            string groupType;
-            cin >> groupType;
+            string mode = command.length() > 8 ? command.substr(8) : "";
+            if (mode == "core")
+                Process::normalizedCpu = false;
+            else if (mode == "total")
+                Process::normalizedCpu = true;
+            else if (!mode.empty())
+                cout << "Invalid cpu mode. Use 'core' or 'total'." << endl;
+            rebuildColumns(); // the cpu column holds the value for the current mode
+            currentView = buildView(columns, viewSettings);
 
-            if (groupType == "owner")
+            cout << "CPU% is shown " << (Process::normalizedCpu ? "as a share of all " + to_string(replay ? replay->getCpuCount() : processTable.getCpuCount()) + " cpus." : "per core.") << endl;
+        }
+        else if (command.substr(0, 7) == "columns")
+        {
+            // "columns" shows the current set, "columns pid,name,cpu", "columns default" or
+            // "columns all" replaces it, "columns +pss,swap" / "columns -owner" adds or removes
+            string list = command.length() > 8 ? command.substr(8) : "";
+            if (!list.empty())
+            {
+                char change = list[0] == '+' || list[0] == '-' ? list[0] : 0;
+                unsigned mask = parseColumnList(change ? list.substr(1) : list);
+                if (!mask)
+                {
+                    cout << "Invalid column list. Use a comma separated list of pid/ppid/name/owner/memory/cpu/status/priority/history/" << endl
+                         << "ioread/iowrite/pss/swap/vcsw/ivcsw/wait, 'default' or 'all'; start it with + or - to add or remove columns." << endl;
+                    continue;
+                }
+                if (change == '+')
+                    mask |= viewSettings.visibleColumns;
+                else if (change == '-')
+                    mask = viewSettings.visibleColumns & ~mask;
+                viewSettings.visibleColumns = mask;
+                processTable.setColumns(viewSettings.neededColumns()); // hidden columns are not read from /proc anymore
+                rebuildColumns();
+                currentView = buildView(columns, viewSettings);
+                displayProcesses(currentView, lastDiff());
+            }
+            cout << "Visible columns: " << describeColumns(viewSettings.visibleColumns)
+                 << " (reading " << describeColumns(processTable.getColumns()) << ")" << endl;
+        }
+        else if (command == "history" || command.substr(0, 8) == "history ")
+        {
+            // "history", "history pid N [seconds]", "history top cpu|rss|io [seconds] [count]",
+            // "history depth N [processes]" or "history off"
+            stringstream args(command.substr(7));
+            string option, arg1, arg2;
+            args >> option >> arg1 >> arg2;
+            if (option == "depth")
             {
-                map<string, vector<Process *>> ownerGroups;
-                for (const auto &proc : currentProcesses)
+                size_t depth, processes = historyProcesses;
+                if (!parseNumeric(arg1, depth) || (!arg2.empty() && !parseNumeric(arg2, processes)))
                 {
-                    ownerGroups[proc->getOwner()].push_back(proc.get());
+                    cout << "Usage: history depth [refreshes] [processes]" << endl;
+                    continue;
                 }
+                historyDepth = depth;
+                historyProcesses = max<size_t>(1, processes);
+                processTable.enableHistory(historyDepth, historyProcesses);
+                rebuildColumns();
+                currentView = buildView(columns, viewSettings);
+                cout << "History cleared, keeping " << processTable.getHistory()->getDepth() << " refreshes of up to "
+                     << historyProcesses << " processes." << endl;
+                continue;
+            }
+            if (option == "off")
+            {
+                processTable.disableHistory();
+                rebuildColumns();
+                currentView = buildView(columns, viewSettings);
+                cout << "History turned off." << endl;
+                continue;
+            }
 
-                cout << "Grouped by owner:\n\n";
-                for (const auto &[owner, group] : ownerGroups)
+            const ProcessHistory *history = processTable.getHistory();
+            if (!history)
+            {
+                cout << "No history is kept. Use 'history depth [refreshes]' to turn it on." << endl;
+                continue;
+            }
+            if (option.empty())
+            {
+                cout << "Keeping " << history->getDepth() << " refreshes of " << history->getTracked() << "/"
+                     << history->getMaxProcesses() << " processes in " << history->memoryBytes() / 1024 << " KB";
+                if (history->getUntracked() > 0)
+                    cout << " (" << history->getUntracked() << " processes not tracked, all slots in use)";
+                cout << "." << endl;
+            }
+            else if (option == "pid")
+            {
+                int pid;
+                if (!parseNumeric(arg1, pid))
                 {
-                    cout << "[+] " << owner << " (" << group.size() << " processes)" << endl;
+                    cout << "Usage: history pid [pid] [seconds]" << endl;
+                    continue;
                 }
-                cout << "\nType 'expand owner [name]' to view details.\n";
+                double seconds = arg2.empty() ? 0 : atof(arg2.c_str());
+                const char *labels[] = {"CPU(%)", "RSS(MB)", "IO(KB/s)"};
+                const double scales[] = {1.0, 1.0 / 1024, 1.0 / 1024};
+                bool found = false;
+                cout << fixed << setprecision(1);
+                for (int metric = 0; metric < 3; metric++)
+                {
+                    ProcessHistory::WindowStats window;
+                    if (!history->stats(pid, (ProcessHistory::Metric)metric, seconds, window))
+                        break;
+                    if (!found)
+                        cout << "PID " << pid << ", " << window.samples << " samples over " << window.seconds << "s:" << endl;
+                    found = true;
+                    double scale = scales[metric];
+                    cout << "  " << left << setw(10) << labels[metric] << right
+                         << history->sparkline(pid, (ProcessHistory::Metric)metric, 32)
+                         << "  min " << window.min * scale << "  max " << window.max * scale << "  avg " << window.avg * scale;
+                    if (metric != (int)ProcessHistory::Metric::Io)
+                        cout << "  growth " << window.growth * scale << "/s";
+                    cout << endl;
+                }
+                if (!found)
+                    cout << "No history for PID " << arg1 << "." << endl;
             }
-            else if (groupType == "parent")
+            else if (option == "top")
             {
-                map<int, vector<Process *>> parentMap;
-                for (const auto &proc : currentProcesses)
+                ProcessHistory::Metric metric;
+                if (arg1 == "cpu")
+                    metric = ProcessHistory::Metric::Cpu;
+                else if (arg1 == "rss" || arg1.empty())
+                    metric = ProcessHistory::Metric::Rss;
+                else if (arg1 == "io")
+                    metric = ProcessHistory::Metric::Io;
+                else
+                {
+                    cout << "Invalid metric. Use cpu, rss or io." << endl;
+                    continue;
+                }
+                string countArg;
+                args >> countArg;
+                double seconds = arg2.empty() ? 0 : atof(arg2.c_str());
+                size_t count = 10;
+                if (!countArg.empty() && !parseNumeric(countArg, count))
                 {
-                    parentMap[proc->getParentPID()].push_back(proc.get());
+                    cout << "Usage: history top [cpu/rss/io] [seconds] [count]" << endl;
+                    continue;
                 }
+                const char *unit = metric == ProcessHistory::Metric::Cpu ? "%/s" : "KB/s";
 
-                cout << "Grouped by parent PID:\n\n";
-                for (const auto &[ppid, group] : parentMap)
+                cout << "Fastest growing " << (arg1.empty() ? "rss" : arg1) << " over "
+                     << (seconds > 0 ? to_string((int)seconds) + "s" : "the whole history") << ":" << endl;
+                cout << fixed << setprecision(2);
+                for (const auto &[pid, rate] : history->topGrowth(metric, seconds, count))
                 {
-                    cout << "[+] PID " << ppid << " (" << group.size() << " children)" << endl;
+                    const Process *proc = processTable.find(pid);
+                    cout << "  PID " << left << setw(8) << pid << setw(25) << (proc ? proc->getName() : "?") << right
+                         << rate << " " << unit << endl;
                 }
-                cout << "\nType 'expand pid [pid]' to view children.\n";
             }
             else
             {
-                cout << "Invalid group type. Use 'owner' or 'parent'." << endl;
+                cout << "Invalid history option. Use 'pid', 'top', 'depth' or 'off'." << endl;
             }
         }
-        else if (command.substr(0, 13) == "expand owner ")
+        else if (command == "watch" || command.substr(0, 6) == "watch ")
         {
-            string ownerName = command.substr(13);
-            map<string, vector<Process *>> ownerGroups;
-            for (const auto &proc : currentProcesses)
+            // "watch [rules-file]" (re)loads the watchdog rules, "watch off" drops them,
+            // plain "watch" lists them with how often each one fired
+            string option = command.length() > 6 ? command.substr(6) : "";
+            if (option == "off")
             {
-                ownerGroups[proc->getOwner()].push_back(proc.get());
+                watchdog.clear();
+                viewSettings.watchColumns = 0;
+                processTable.setColumns(viewSettings.neededColumns());
+                cout << "Watchdog off." << endl;
+                continue;
             }
-
-            if (ownerGroups.find(ownerName) != ownerGroups.end())
+            if (!option.empty())
             {
-                cout << "\nProcesses owned by: " << ownerName << "\n";
-                for (const auto *proc : ownerGroups[ownerName])
+                string error;
+                if (!watchdog.load(option, error))
                 {
-                    cout << "  PID " << proc->getPID() << " | Name: " << proc->getName()
-                         << " | PPID: " << proc->getParentPID() << endl;
+                    cout << "Cannot load the rules: " << error << endl;
+                    continue;
                 }
+                viewSettings.watchColumns = watchdog.getColumns();
+                processTable.setColumns(viewSettings.neededColumns());
+                cout << "Watching " << watchdog.getRules().size() << " rules from " << option << ", checked on every refresh";
+                if (!watchdog.getLogPath().empty())
+                    cout << ", logging to " << watchdog.getLogPath();
+                cout << "." << endl;
+                continue;
             }
-            else
+            if (watchdog.empty())
             {
-                cout << "Owner group not found." << endl;
+                cout << "No watchdog rules. Use 'watch [rules-file]' to load some." << endl;
+                continue;
+            }
+            cout << left << setw(20) << "Rule" << setw(8) << "Fired" << setw(12) << "Suppressed" << setw(10) << "Pending" << "Definition" << endl;
+            for (const Watchdog::Rule &rule : watchdog.getRules())
+            {
+                size_t pending = 0;
+                for (const auto &[pid, state] : rule.pending)
+                    pending += !state.fired;
+                cout << setw(20) << rule.name.substr(0, 19) << setw(8) << rule.fired << setw(12) << rule.suppressed
+                     << setw(10) << pending << rule.text << endl;
             }
+            cout << right << "Last check took " << fixed << setprecision(3) << refreshStats.lastMs[(int)Phase::Watchdog] << " ms." << endl;
         }
-        else if (command.substr(0, 11) == "expand pid ")
+        else if (command == "threads" || command.substr(0, 8) == "threads ")
         {
-            int parentPid = stoi(command.substr(11));
-            map<int, vector<Process *>> parentMap;
-            for (const auto &proc : currentProcesses)
+            // "threads all", "threads [pid] [pid]..." or "threads off", plain "threads" shows the selection
+            stringstream args(command.substr(7));
+            string word;
+            vector<int> selected;
+            bool all = false, off = false, valid = true;
+            int pid;
+            while (args >> word)
+            {
+                if (word == "all")
+                    all = true;
+                else if (word == "off")
+                    off = true;
+                else if (parseNumeric(word, pid))
+                    selected.push_back(pid);
+                else
+                    valid = false;
+            }
+            if (!valid || (all + off + !selected.empty()) > 1)
+            {
+                cout << "Usage: threads all | threads [pid] [pid]... | threads off" << endl;
+                continue;
+            }
+            if (!all && !off && selected.empty())
+            {
+                if (!processTable.showsThreads())
+                    cout << "Thread view is off. Use 'threads all' or 'threads [pid]...' to list threads." << endl;
+                else
+                    cout << "Listing " << processTable.threadRowCount() << " threads of "
+                         << (processTable.showsAllThreads() ? "every process" : to_string(processTable.getThreadPids().size()) + " selected process(es)") << "." << endl;
+                continue;
+            }
+            if (off)
+                processTable.hideThreads();
+            else
+                processTable.showThreads(all, selected);
+            const SnapshotDiff &diff = nextSnapshot(); // threads are listed from the next refresh on
+            currentView = buildView(columns, viewSettings);
+            displayProcesses(currentView, &diff);
+            if (off)
+                cout << "Thread view off." << endl;
+            else
+                cout << "Listing " << processTable.threadRowCount() << " threads." << endl;
+        }
+        else if (command == "stats" || command.substr(0, 6) == "stats ")
+        {
+            // "stats" prints the last refresh phase by phase, "stats on/off" toggles the status line
+            string option = command.length() > 6 ? command.substr(6) : "";
+            if (option == "on" || option == "off")
             {
-                parentMap[proc->getParentPID()].push_back(proc.get());
+                refreshStats.statusLine = option == "on";
+                cout << "Status line " << (refreshStats.statusLine ? "on." : "off.") << endl;
+                continue;
+            }
+            if (!option.empty())
+            {
+                cout << "Invalid option. Use 'stats', 'stats on' or 'stats off'." << endl;
+                continue;
             }
 
-            if (parentMap.find(parentPid) != parentMap.end())
+            cout << fixed << setprecision(2);
+            cout << left << setw(14) << "Phase" << setw(12) << "Last (ms)" << setw(12) << "Avg (ms)" << "Allocations" << endl;
+            for (int phase = 0; phase < RefreshStats::Phases; phase++)
             {
-                cout << "\nChildren of PID " << parentPid << ":\n";
-                for (const auto *proc : parentMap[parentPid])
+                double average = refreshStats.samples[phase] ? refreshStats.totalMs[phase] / refreshStats.samples[phase] : 0;
+                cout << setw(14) << phaseNames[phase] << setw(12) << refreshStats.lastMs[phase] << setw(12) << average;
+                if (phase >= (int)Phase::Watchdog)
+                    cout << refreshStats.lastAllocations[phase];
+                cout << endl;
+            }
+            cout << right << "Last refresh: " << refreshStats.refreshMs() << " ms, " << refreshStats.opens << " files opened, "
+                 << refreshStats.reads << " reads, " << refreshStats.bytes / 1024.0 << " KB read, "
+                 << refreshStats.allocations << " heap allocations." << endl;
+            cout << "User cache: " << userCache.getHits() << " hits, " << userCache.getMisses() << " getpwuid() calls. "
+                 << refreshStats.refreshes << " refreshes so far; read and parse are summed over "
+                 << processTable.getThreadCount() << " scan thread(s)." << endl;
+        }
+        else if (command.substr(0, 9) == "usercache")
+        {
+            string option = command.length() > 10 ? command.substr(10) : "";
+            if (option == "reload")
+            {
+                userCache.clear();
+                cout << "Loaded " << userCache.reload() << " users from /etc/passwd." << endl;
+            }
+            else if (option.substr(0, 4) == "ttl ")
+            {
+                try
                 {
-                    cout << "  PID " << proc->getPID() << " | Name: " << proc->getName()
-                         << " | Owner: " << proc->getOwner() << endl;
+                    userCache.setTtl(chrono::seconds(max(0, stoi(option.substr(4)))));
                 }
+                catch (...)
+                {
+                    cout << "Invalid ttl." << endl;
+                }
+            }
+            else if (!option.empty())
+            {
+                cout << "Invalid option. Use 'usercache', 'usercache reload' or 'usercache ttl [seconds]'." << endl;
             }
+
+            cout << "User cache: " << userCache.size() << " uids, " << userCache.getHits() << " hits, "
+                 << userCache.getMisses() << " getpwuid calls, ttl ";
+            if (userCache.getTtl().count() == 0)
+                cout << "off" << endl;
             else
+                cout << userCache.getTtl().count() << "s" << endl;
+        }
+        else if (command == "events" || command.substr(0, 7) == "events ")
+        {
+            string option = command.length() > 7 ? command.substr(7) : "";
+            if (option == "on" && !processTable.getEvents())
             {
-                cout << "No children found for PID " << parentPid << "." << endl;
+                string error;
+                if (!processTable.enableEvents(error))
+                    cout << "Process events unavailable, still scanning /proc: " << error << endl;
+            }
+            else if (option == "off")
+            {
+                processTable.disableEvents();
+            }
+            else if (!option.empty() && option != "on")
+            {
+                cout << "Invalid option. Use 'events', 'events on' or 'events off'." << endl;
+            }
+
+            const ProcEventSource *events = processTable.getEvents();
+            if (!events)
+            {
+                cout << "Process events: off (every refresh walks /proc)." << endl;
+                continue;
+            }
+            cout << "Process events: on, " << events->getEventCount() << " events received, "
+                 << processTable.getEventScans() << " event-driven refreshes, "
+                 << processTable.getFullScans() << " full /proc walks." << endl;
+
+            vector<ProcEventSource::ShortLived> shortLived = events->getShortLived();
+            size_t first = shortLived.size() > 20 ? shortLived.size() - 20 : 0;
+            cout << "Short-lived processes (started and exited between refreshes): " << shortLived.size() << endl;
+            for (size_t i = first; i < shortLived.size(); i++)
+            {
+                cout << "  PID " << shortLived[i].pid << " | Name: " << shortLived[i].name
+                     << " | PPID: " << shortLived[i].ppid << " | Exit code: " << shortLived[i].exitCode << endl;
+            }
+        }
+        else if (command == "fdcache" || command.substr(0, 8) == "fdcache ")
+        {
+            string option = command.length() > 8 ? command.substr(8) : "";
+            if (option == "on")
+            {
+                Process::fdCacheEnabled = true;
+            }
+            else if (option == "off")
+            {
+                Process::fdCacheEnabled = false;
+                processTable.closeCachedFds();
+            }
+            else if (!option.empty())
+            {
+                cout << "Invalid option. Use 'fdcache', 'fdcache on' or 'fdcache off'." << endl;
+            }
+            cout << "fd cache: " << (Process::fdCacheEnabled ? "on" : "off") << ", " << fdBudget.getUsed()
+                 << " of " << fdBudget.getLimit() << " fds in use. /proc reads so far: " << procReadCounters.opens << " opens, "
+                 << procReadCounters.reads << " reads, " << procReadCounters.closes << " closes." << endl;
+        }
+        else if (command == "iouring" || command.substr(0, 8) == "iouring ")
+        {
+            string option = command.length() > 8 ? command.substr(8) : "";
+            if (option == "on" && !processTable.usesIoUring())
+            {
+                string error;
+                if (!processTable.enableIoUring(error))
+                    cout << "io_uring unavailable, still reading /proc synchronously: " << error << endl;
+            }
+            else if (option == "off")
+            {
+                processTable.disableIoUring();
+            }
+            else if (!option.empty() && option != "on")
+            {
+                cout << "Invalid option. Use 'iouring', 'iouring on' or 'iouring off'." << endl;
             }
+            cout << "io_uring: " << (processTable.usesIoUring() ? "on" : "off") << ". /proc reads so far: "
+                 << procReadCounters.opens << " opens, " << procReadCounters.reads << " reads, " << procReadCounters.closes
+                 << " closes in " << procReadCounters.submits << " io_uring submissions." << endl;
         }
         else if (!command.empty())
         {